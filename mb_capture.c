@@ -0,0 +1,193 @@
+/*
+*报文捕获环的实现。
+*
+*捕获环是一段固定大小的字节数组，写位置cap_head和最旧记录位置cap_tail都是自由递增的32位数，
+*取模后得到数组下标，记录可以跨越数组末尾。写入一条记录时，只在SYS_ARCH_PROTECT保护下
+*预留空间、写入8字节记录头并在必要时推进cap_tail，随后在保护区外拷贝数据，因此请求处理路径上
+*既不分配内存也不会因等待锁而阻塞。导出时先冻结捕获环并等待正在拷贝的记录完成，导出期间
+*到达的记录被丢弃并计数。
+*/
+
+#include <string.h>
+#include "lwip/sys.h"
+#include "lwip/api.h"
+#include "mb_stats.h"
+#include "mb_capture.h"
+
+#if (MB_CAPTURE_SIZE & (MB_CAPTURE_SIZE - 1)) != 0
+#error "MB_CAPTURE_SIZE must be a power of 2"
+#endif
+
+#define  MB_CAPTURE_MASK   (MB_CAPTURE_SIZE - 1)
+
+static unsigned char cap_ring[MB_CAPTURE_SIZE];
+static u32_t cap_head;                 //下一条记录的写入位置
+static u32_t cap_tail;                 //最旧记录的起始位置
+static u32_t cap_writers;              //已预留空间、正在拷贝数据的记录数
+static u32_t cap_dropped;              //导出期间丢弃的记录数
+static volatile u8_t cap_frozen;       //导出中，暂停捕获
+
+//向捕获环pos处写入数据，自动处理回绕
+static void ModbusCaptureCopy(u32_t pos, const unsigned char *data, u16_t len)
+{
+	u32_t off = pos & MB_CAPTURE_MASK;
+	u32_t n = MB_CAPTURE_SIZE - off;
+
+	if (n >= len)
+	{
+		memcpy(&cap_ring[off], data, len);
+	}
+	else
+	{
+		memcpy(&cap_ring[off], data, n);
+		memcpy(cap_ring, data + n, len - n);
+	}
+}
+
+//读取pos处记录的总长度（记录头加数据）
+static u32_t ModbusCaptureRecLen(u32_t pos)
+{
+	u16_t len = (u16_t)((cap_ring[pos & MB_CAPTURE_MASK] << 8) | cap_ring[(pos + 1) & MB_CAPTURE_MASK]);
+
+	return MB_CAPTURE_REC_HDR + len;
+}
+
+/**
+*向捕获环写入一条记录，由请求处理路径调用
+*type:记录类型MB_CAP_xxx；data:帧数据；len:帧长度，超过MB_CAPTURE_DATA_MAX时被截断
+*/
+void ModbusCaptureRecord(unsigned char type, const unsigned char *data, unsigned short len)
+{
+	unsigned char hdr[MB_CAPTURE_REC_HDR];
+	INT32U now;
+	u32_t pos;
+	SYS_ARCH_DECL_PROTECT(lev);
+
+	if (len > MB_CAPTURE_DATA_MAX)
+	{
+		len = MB_CAPTURE_DATA_MAX;
+	}
+
+	hdr[0] = (unsigned char)(len >> 8);
+	hdr[1] = (unsigned char)(len);
+	hdr[2] = type;
+	hdr[3] = (unsigned char)ModbusStatsSlot();
+
+	SYS_ARCH_PROTECT(lev);
+	if (cap_frozen)
+	{
+		cap_dropped++;
+		SYS_ARCH_UNPROTECT(lev);
+		return;
+	}
+
+	//在预留空间的同一保护区内取时间戳，环中记录的顺序与时间戳顺序一致
+	now = OSTimeGet();
+	hdr[4] = (unsigned char)(now >> 24);
+	hdr[5] = (unsigned char)(now >> 16);
+	hdr[6] = (unsigned char)(now >> 8);
+	hdr[7] = (unsigned char)(now);
+
+	//预留空间，覆盖最旧的记录直到空间足够；记录头在保护区内写入，推进cap_tail时读到的记录头总是完整的
+	pos = cap_head;
+	cap_head += MB_CAPTURE_REC_HDR + len;
+	while (cap_head - cap_tail > MB_CAPTURE_SIZE)
+	{
+		cap_tail += ModbusCaptureRecLen(cap_tail);
+	}
+	ModbusCaptureCopy(pos, hdr, MB_CAPTURE_REC_HDR);
+	cap_writers++;
+	SYS_ARCH_UNPROTECT(lev);
+
+	ModbusCaptureCopy(pos + MB_CAPTURE_REC_HDR, data, len);
+
+	SYS_ARCH_PROTECT(lev);
+	cap_writers--;
+	SYS_ARCH_UNPROTECT(lev);
+}
+
+//读取导出期间丢弃的记录数
+unsigned int ModbusCaptureDropped(void)
+{
+	return cap_dropped;
+}
+
+//导出捕获环：冻结捕获，发送文件头和cap_tail至cap_head之间的全部记录后恢复捕获
+static void ModbusCaptureDump(struct netconn *conn)
+{
+	unsigned char hdr[MB_CAPTURE_FILE_HDR];
+	u32_t pos, end, off, n;
+	err_t err;
+	SYS_ARCH_DECL_PROTECT(lev);
+
+	SYS_ARCH_PROTECT(lev);
+	cap_frozen = 1;
+	SYS_ARCH_UNPROTECT(lev);
+
+	//等待已预留空间的记录拷贝完成
+	while (cap_writers != 0)
+	{
+		OSTimeDly(1);
+	}
+
+	hdr[0] = (unsigned char)(MB_CAPTURE_MAGIC >> 24);
+	hdr[1] = (unsigned char)(MB_CAPTURE_MAGIC >> 16);
+	hdr[2] = (unsigned char)(MB_CAPTURE_MAGIC >> 8);
+	hdr[3] = (unsigned char)(MB_CAPTURE_MAGIC);
+	hdr[4] = MB_CAPTURE_VERSION;
+	hdr[5] = 0;
+	hdr[6] = (unsigned char)(OS_TICKS_PER_SEC >> 8);
+	hdr[7] = (unsigned char)(OS_TICKS_PER_SEC);
+	hdr[8] = (unsigned char)(cap_dropped >> 24);
+	hdr[9] = (unsigned char)(cap_dropped >> 16);
+	hdr[10] = (unsigned char)(cap_dropped >> 8);
+	hdr[11] = (unsigned char)(cap_dropped);
+
+	err = netconn_write(conn, hdr, MB_CAPTURE_FILE_HDR, NETCONN_COPY);
+
+	//记录可能跨越数组末尾，分两段发送
+	pos = cap_tail;
+	end = cap_head;
+	while (err == ERR_OK && pos != end)
+	{
+		off = pos & MB_CAPTURE_MASK;
+		n = MB_CAPTURE_SIZE - off;
+		if (n > end - pos)
+		{
+			n = end - pos;
+		}
+		err = netconn_write(conn, &cap_ring[off], n, NETCONN_COPY);
+		pos += n;
+	}
+
+	cap_frozen = 0;
+}
+
+//捕获任务：在TCP捕获端口上侦听，每个连接导出一次捕获环后关闭
+static void ModbusCaptureThread(void *arg)
+{
+	struct netconn *conn, *newconn;
+
+	conn = netconn_new(NETCONN_TCP);
+	netconn_bind(conn, NULL, MB_CAPTURE_PORT);
+	netconn_listen(conn);
+
+	while(1)
+	{
+		if (netconn_accept(conn, &newconn) != ERR_OK)
+		{
+			continue;
+		}
+
+		ModbusCaptureDump(newconn);
+
+		netconn_close(newconn);
+		netconn_delete(newconn);
+	}
+}
+
+//捕获模块初始化，创建捕获任务
+void ModbusCaptureInit(void)
+{
+	sys_thread_new("mb_capture_thread", ModbusCaptureThread, NULL, MB_CAPTURE_THREAD_STKSIZE, MB_CAPTURE_THREAD_PRIO);
+}
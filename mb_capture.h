@@ -0,0 +1,50 @@
+#ifndef __MB_CAPTURE_H__
+#define __MB_CAPTURE_H__
+
+/**
+*报文捕获环。服务器/网关处理的每个Modbus/TCP请求、响应以及RS485上的RTU请求、响应都以
+*紧凑的二进制记录写入一个固定大小的环形缓冲区，写满后覆盖最旧的记录。连接TCP捕获端口
+*即可导出环中的全部记录，导出的数据可直接交给主机工具mb_replay回放。
+*
+*导出格式（多字节字段均为大端字节序）：
+*文件头：魔数"MBCP"(4) 版本(1) 保留(1) 系统节拍频率(2) 丢弃的记录数(4)
+*记录：  数据长度(2) 记录类型(1) 子任务号(1) 时间戳，系统节拍(4) 数据
+*其中Modbus/TCP记录的数据为完整的ADU，RTU记录的数据为地址域加PDU（不含CRC）。
+*子任务号即客户端子任务的堆栈区索引，同一子任务号的记录来自同一条客户端连接（或其后继连接）。
+**/
+
+//捕获环大小（字节），必须为2的幂
+#ifndef MB_CAPTURE_SIZE
+#define  MB_CAPTURE_SIZE         8192
+#endif
+
+//TCP捕获导出端口
+#ifndef MB_CAPTURE_PORT
+#define  MB_CAPTURE_PORT         5021
+#endif
+
+#define  MB_CAPTURE_MAGIC        0x4D424350      //"MBCP"
+#define  MB_CAPTURE_VERSION      1
+#define  MB_CAPTURE_FILE_HDR     12              //文件头长度
+#define  MB_CAPTURE_REC_HDR      8               //记录头长度
+#define  MB_CAPTURE_DATA_MAX     260             //单条记录最多保存的数据长度，超出部分被截断
+
+//记录类型
+#define  MB_CAP_TCP_REQ          1               //客户端的Modbus/TCP请求
+#define  MB_CAP_TCP_RSP          2               //返回给客户端的Modbus/TCP响应
+#define  MB_CAP_RTU_REQ          3               //发往RS485的RTU请求
+#define  MB_CAP_RTU_RSP          4               //RS485上收到的RTU响应
+
+//捕获任务优先级及堆栈大小
+#ifndef MB_CAPTURE_THREAD_PRIO
+#define  MB_CAPTURE_THREAD_PRIO    (TCPIP_THREAD_PRIO+4)
+#endif
+#ifndef MB_CAPTURE_THREAD_STKSIZE
+#define  MB_CAPTURE_THREAD_STKSIZE DEFAULT_THREAD_STACKSIZE
+#endif
+
+void ModbusCaptureInit(void);
+void ModbusCaptureRecord(unsigned char type, const unsigned char *data, unsigned short len);
+unsigned int ModbusCaptureDropped(void);
+
+#endif /* __MB_CAPTURE_H__ */
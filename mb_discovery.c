@@ -0,0 +1,97 @@
+/*
+*网关发现通告的实现（网关侧）。
+*
+*通告任务每隔MB_DISC_INTERVAL向多播组发送一次通告；空闲连接数发生变化（接受或关闭了连接）时提前发送，
+*以便客户端尽快得知某台网关已满。UID位图在启动时由配置的RS485 UID范围和下游Modbus/TCP路由表生成，
+*之后保持不变。发送多播数据报无需加入多播组。
+*/
+
+#include <string.h>
+#include "lwip/sys.h"
+#include "lwip/api.h"
+#include "tcp_rtu.h"
+#include "tcp_tcp.h"
+#include "mb_discovery.h"
+
+//检查空闲连接数是否变化的周期（毫秒），及换算后的系统节拍数，系统节拍较慢时至少为1个节拍
+#define  MB_DISC_POLL     (MB_DISC_INTERVAL / 10)
+#define  MB_DISC_POLL_TICKS \
+	(((INT32U)MB_DISC_POLL * OS_TICKS_PER_SEC / 1000) > 0 ? ((INT32U)MB_DISC_POLL * OS_TICKS_PER_SEC / 1000) : 1)
+
+static unsigned char disc_pkt[MB_DISC_PKT_SIZE];
+
+//生成UID位图：RS485上的UID范围，加上路由到下游Modbus/TCP设备的UID
+static void ModbusDiscoveryUidMap(unsigned char *map)
+{
+	unsigned int uid;
+
+	memset(map, 0, 32);
+	for (uid = 0; uid < 256; uid++)
+	{
+		if ((uid >= MB_DISC_RTU_UID_FIRST && uid <= MB_DISC_RTU_UID_LAST)
+			|| ModbusTcpGateRoute((unsigned char)uid) != NULL)
+		{
+			map[uid >> 3] |= (unsigned char)(1 << (uid & 0x07));
+		}
+	}
+}
+
+//通告任务
+static void ModbusDiscoveryThread(void *arg)
+{
+	struct netconn *conn;
+	struct netbuf *buf;
+	struct ip_addr group;
+	unsigned int free, total, queue, free_last = ~0U;
+	INT32U now, tick_last = 0;
+	u16_t seq = 0;
+
+	MB_DISC_GROUP(&group);
+	conn = netconn_new(NETCONN_UDP);
+
+	//通告数据报中不变的部分
+	disc_pkt[0] = (unsigned char)(MB_DISC_MAGIC >> 24);
+	disc_pkt[1] = (unsigned char)(MB_DISC_MAGIC >> 16);
+	disc_pkt[2] = (unsigned char)(MB_DISC_MAGIC >> 8);
+	disc_pkt[3] = (unsigned char)(MB_DISC_MAGIC);
+	disc_pkt[4] = MB_DISC_VERSION;
+	disc_pkt[8] = (unsigned char)(MB_DISC_MODBUS_PORT >> 8);
+	disc_pkt[9] = (unsigned char)(MB_DISC_MODBUS_PORT);
+	ModbusDiscoveryUidMap(&disc_pkt[12]);
+
+	while(1)
+	{
+		free = ModbusConnFree(&total);
+		now = OSTimeGet();
+
+		if (free != free_last || now - tick_last >= (INT32U)MB_DISC_INTERVAL * OS_TICKS_PER_SEC / 1000)
+		{
+			queue = ModbusGateBusQueue();
+			disc_pkt[5] = (unsigned char)(free > 0xFF ? 0xFF : free);
+			disc_pkt[6] = (unsigned char)(total > 0xFF ? 0xFF : total);
+			disc_pkt[7] = (unsigned char)(queue > 0xFF ? 0xFF : queue);
+			disc_pkt[10] = (unsigned char)(seq >> 8);
+			disc_pkt[11] = (unsigned char)(seq);
+			seq++;
+
+			buf = netbuf_new();
+			if (buf != NULL)
+			{
+				netbuf_ref(buf, disc_pkt, MB_DISC_PKT_SIZE);
+				netconn_sendto(conn, buf, &group, MB_DISC_PORT);
+				netbuf_delete(buf);
+			}
+
+			free_last = free;
+			tick_last = now;
+		}
+
+		OSTimeDly(MB_DISC_POLL_TICKS);
+	}
+}
+
+//网关发现初始化，创建通告任务
+void ModbusDiscoveryInit(void)
+{
+	sys_thread_new("mb_disc_thread", ModbusDiscoveryThread, NULL, MB_DISC_THREAD_STKSIZE, MB_DISC_THREAD_PRIO);
+}
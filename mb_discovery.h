@@ -0,0 +1,87 @@
+#ifndef __MB_DISCOVERY_H__
+#define __MB_DISCOVERY_H__
+
+/**
+*网关发现与负载通告。同一RS485网段上可部署多台网关，每台网关周期性地向多播组发送通告数据报，
+*其中包含网关可服务的单元标识符（UID）、空闲的连接数和RS485总线上排队的请求数。客户端加入该多播组
+*（与igmp_test.c相同，使用IGMP），维护一张网关表，并由ModbusDiscoverySelect为某个UID选择负载最轻的网关，
+*使客户端连接分散到各台网关上，而不是集中在某一台网关直到其达到MAX_CLIENT_NUM。
+*
+*通告数据报格式（多字节字段均为大端字节序），共44字节：
+*魔数"MBGW"(4) 版本(1) 空闲连接数(1) 最大连接数(1) 总线排队请求数(1) Modbus/TCP端口(2) 序号(2)
+*UID位图(32)，第uid位（字节uid/8的第uid%8位）为1表示该网关可服务此UID
+**/
+
+#include "lwip/api.h"
+
+//多播组地址及端口，需要网卡驱动使能多播接收，并定义LWIP_IGMP为1（见igmp_test.c）
+#ifndef MB_DISC_GROUP
+#define  MB_DISC_GROUP(ipaddr)     IP4_ADDR((ipaddr), 233, 0, 0, 8)
+#endif
+#ifndef MB_DISC_PORT
+#define  MB_DISC_PORT              5022
+#endif
+
+//网关发送通告的周期（毫秒），客户端超过MB_DISC_AGE未收到某网关的通告即认为其已离线
+#ifndef MB_DISC_INTERVAL
+#define  MB_DISC_INTERVAL          1000
+#endif
+#ifndef MB_DISC_AGE
+#define  MB_DISC_AGE               (3 * MB_DISC_INTERVAL)
+#endif
+
+//网关通过RS485可服务的UID范围，应按本网关RS485总线上实际连接的从站配置，路由到下游Modbus/TCP设备的UID
+//（见tcp_tcp.h）自动加入。默认为空范围（FIRST大于LAST）：若默认通告1~247，每台网关都会声称服务所有UID，
+//客户端便无法按UID选择网关
+#ifndef MB_DISC_RTU_UID_FIRST
+#define  MB_DISC_RTU_UID_FIRST     1
+#endif
+#ifndef MB_DISC_RTU_UID_LAST
+#define  MB_DISC_RTU_UID_LAST      0
+#endif
+
+//网关的Modbus/TCP服务端口
+#ifndef MB_DISC_MODBUS_PORT
+#define  MB_DISC_MODBUS_PORT       502
+#endif
+
+//客户端网关表大小
+#ifndef MB_DISC_GW_NUM
+#define  MB_DISC_GW_NUM            8
+#endif
+
+#define  MB_DISC_MAGIC             0x4D424757      //"MBGW"
+#define  MB_DISC_VERSION           1
+#define  MB_DISC_PKT_SIZE          44
+
+//通告任务与侦听任务的优先级及堆栈大小
+#ifndef MB_DISC_THREAD_PRIO
+#define  MB_DISC_THREAD_PRIO       (TCPIP_THREAD_PRIO+5)
+#endif
+#ifndef MB_DISC_THREAD_STKSIZE
+#define  MB_DISC_THREAD_STKSIZE    DEFAULT_THREAD_STACKSIZE
+#endif
+
+//客户端网关表项
+typedef struct
+{
+	struct ip_addr addr;          //网关IP地址，取自通告数据报的源地址
+	unsigned short port;          //网关Modbus/TCP端口
+	unsigned char  free;          //空闲连接数，本地选中后预先减1，收到下一次通告时更新
+	unsigned char  max;           //最大连接数
+	unsigned char  queue;         //总线排队请求数
+	unsigned char  uid_map[32];   //UID位图
+	unsigned int   last_seen;     //最近一次收到通告的时间（系统节拍），0表示空闲表项
+}mb_gateway_t;
+
+//网关侧：启动通告任务，在网关服务器主任务启动时调用
+void ModbusDiscoveryInit(void);
+
+//客户端侧：加入多播组并启动侦听任务，选择网关
+void ModbusDiscoveryListenInit(void);
+int  ModbusDiscoverySelect(unsigned char uid, mb_gateway_t *gw);
+
+//查询空闲的子任务堆栈区（即还可接受的连接）数量，total返回最大连接数，在modbus_tcp.c中实现
+unsigned int ModbusConnFree(unsigned int *total);
+
+#endif /* __MB_DISCOVERY_H__ */
@@ -0,0 +1,157 @@
+/*
+*网关发现的客户端侧实现：加入通告多播组，根据收到的通告维护网关表，并为UID选择负载最轻的网关。
+*
+*选择规则：只考虑在MB_DISC_AGE内发送过通告且可服务该UID的网关，优先选择有空闲连接的网关，
+*其次选择总线排队请求数最少的网关，再次选择空闲连接数最多的网关。选中后将该网关的空闲连接数预先减1，
+*避免同一通告周期内的多次选择都落到同一台网关上；收到该网关的下一次通告时以通告中的值为准。
+*/
+
+#include <string.h>
+#include "lwip/sys.h"
+#include "lwip/api.h"
+#include "mb_discovery.h"
+
+#define  MB_DISC_AGE_TICKS   ((INT32U)MB_DISC_AGE * OS_TICKS_PER_SEC / 1000)
+
+//网关表，由disc_sem保护
+static mb_gateway_t disc_gw[MB_DISC_GW_NUM];
+static sys_sem_t disc_sem;
+
+//根据通告更新网关表，表满时替换最久未收到通告的网关
+static void ModbusDiscoveryUpdate(struct ip_addr *addr, const unsigned char *pkt)
+{
+	mb_gateway_t *gw = NULL, *oldest = &disc_gw[0];
+	unsigned short port = (unsigned short)((pkt[8] << 8) | pkt[9]);
+	INT32U now = OSTimeGet();
+	unsigned int i;
+
+	if (now == 0)
+	{
+		now = 1;                 //0表示空闲表项
+	}
+
+	sys_sem_wait(&disc_sem);
+
+	for (i = 0; i < MB_DISC_GW_NUM; i++)
+	{
+		if (disc_gw[i].last_seen != 0 && ip_addr_cmp(&disc_gw[i].addr, addr) && disc_gw[i].port == port)
+		{
+			gw = &disc_gw[i];
+			break;
+		}
+		if (disc_gw[i].last_seen == 0)
+		{
+			oldest = &disc_gw[i];
+		}
+		else if (oldest->last_seen != 0 && now - disc_gw[i].last_seen > now - oldest->last_seen)
+		{
+			oldest = &disc_gw[i];
+		}
+	}
+	if (gw == NULL)
+	{
+		gw = oldest;
+	}
+
+	ip_addr_set(&gw->addr, addr);
+	gw->port = port;
+	gw->free = pkt[5];
+	gw->max = pkt[6];
+	gw->queue = pkt[7];
+	memcpy(gw->uid_map, &pkt[12], sizeof(gw->uid_map));
+	gw->last_seen = now;
+
+	sys_sem_signal(&disc_sem);
+}
+
+//侦听任务：加入多播组，接收网关通告
+static void ModbusDiscoveryListenThread(void *arg)
+{
+	struct netconn *conn;
+	struct netbuf *inbuf;
+	struct ip_addr group;
+	unsigned char pkt[MB_DISC_PKT_SIZE];
+
+	MB_DISC_GROUP(&group);
+	conn = netconn_new(NETCONN_UDP);
+	netconn_bind(conn, NULL, MB_DISC_PORT);
+	netconn_join_leave_group(conn, &group, IP_ADDR_ANY, NETCONN_JOIN);
+
+	while(1)
+	{
+		if (netconn_recv(conn, &inbuf) != ERR_OK)
+		{
+			continue;
+		}
+
+		if (netbuf_len(inbuf) == MB_DISC_PKT_SIZE && netbuf_copy(inbuf, pkt, MB_DISC_PKT_SIZE) == MB_DISC_PKT_SIZE
+			&& ((u32_t)pkt[0] << 24 | (u32_t)pkt[1] << 16 | (u32_t)pkt[2] << 8 | pkt[3]) == MB_DISC_MAGIC
+			&& pkt[4] == MB_DISC_VERSION)
+		{
+			ModbusDiscoveryUpdate(netbuf_fromaddr(inbuf), pkt);
+		}
+
+		netbuf_delete(inbuf);
+	}
+}
+
+//网关发现客户端初始化，创建侦听任务
+void ModbusDiscoveryListenInit(void)
+{
+	memset(disc_gw, 0, sizeof(disc_gw));
+	sys_sem_new(&disc_sem, 1);
+	sys_thread_new("mb_disc_listen_thread", ModbusDiscoveryListenThread, NULL, MB_DISC_THREAD_STKSIZE, MB_DISC_THREAD_PRIO);
+}
+
+/**
+*为UID选择负载最轻的网关
+*uid:目标单元标识符；gw:返回选中网关的表项副本（IP地址、端口等）
+*返回值：找到可服务该UID的网关返回0，否则返回-1
+*/
+int ModbusDiscoverySelect(unsigned char uid, mb_gateway_t *gw)
+{
+	mb_gateway_t *best = NULL, *e;
+	INT32U now = OSTimeGet();
+	unsigned int i;
+
+	sys_sem_wait(&disc_sem);
+
+	for (i = 0; i < MB_DISC_GW_NUM; i++)
+	{
+		e = &disc_gw[i];
+		if (e->last_seen == 0)
+		{
+			continue;
+		}
+		if (now - e->last_seen > MB_DISC_AGE_TICKS)
+		{
+			e->last_seen = 0;        //网关已离线，释放表项
+			continue;
+		}
+		if (!(e->uid_map[uid >> 3] & (1 << (uid & 0x07))))
+		{
+			continue;
+		}
+
+		if (best == NULL
+			|| (e->free > 0 && best->free == 0)
+			|| ((e->free > 0) == (best->free > 0)
+				&& (e->queue < best->queue || (e->queue == best->queue && e->free > best->free))))
+		{
+			best = e;
+		}
+	}
+
+	if (best != NULL)
+	{
+		if (best->free > 0)
+		{
+			best->free--;
+		}
+		*gw = *best;
+	}
+
+	sys_sem_signal(&disc_sem);
+
+	return (best != NULL) ? 0 : -1;
+}
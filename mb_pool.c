@@ -0,0 +1,132 @@
+/*
+*Modbus服务器静态内存池的实现。每个内存池对应一块静态存储区，初始化时将存储区切分为
+*等长的块并串成空闲链表。分配和释放只需修改链表头指针，在SYS_ARCH_PROTECT保护的
+*临界区内完成（与lwip的memp相同），临界区仅包含几条指令，不会阻塞其他任务。
+*/
+
+#include "lwip/sys.h"
+#include "mb_pool.h"
+
+//空闲块链表节点，块空闲时复用块本身的存储空间
+struct mb_pool_blk
+{
+	struct mb_pool_blk *next;
+};
+
+//块大小按指针长度对齐，保证每个块都可以存放链表节点
+#define  MBPOOL_ALIGN_SIZE(size)  (((size) + sizeof(void *) - 1) & ~(sizeof(void *) - 1))
+
+//各内存池的静态存储区，以指针为数组元素以保证起始地址对齐
+#define  MBPOOL_STORAGE(id, name, size, num) \
+	static void *mbpool_mem_##id[(MBPOOL_ALIGN_SIZE(size) * (num)) / sizeof(void *)];
+MBPOOL_TABLE(MBPOOL_STORAGE)
+
+#define  MBPOOL_BASE(id, name, size, num)  (unsigned char *)mbpool_mem_##id,
+#define  MBPOOL_SIZE(id, name, size, num)  MBPOOL_ALIGN_SIZE(size),
+#define  MBPOOL_NUM(id, name, size, num)   (num),
+#define  MBPOOL_NAME(id, name, size, num)  name,
+
+static unsigned char * const mbpool_base[MBPOOL_MAX] = { MBPOOL_TABLE(MBPOOL_BASE) };
+static const unsigned short  mbpool_size[MBPOOL_MAX] = { MBPOOL_TABLE(MBPOOL_SIZE) };
+static const unsigned short  mbpool_num[MBPOOL_MAX]  = { MBPOOL_TABLE(MBPOOL_NUM) };
+static const char * const    mbpool_name[MBPOOL_MAX] = { MBPOOL_TABLE(MBPOOL_NAME) };
+
+//各内存池的空闲链表表头及统计信息
+static struct mb_pool_blk *mbpool_free[MBPOOL_MAX];
+static mb_pool_stats_t     mbpool_stats[MBPOOL_MAX];
+
+//内存池初始化，将各存储区切分为块并串成空闲链表，须在服务器任务启动前调用
+void ModbusPoolInit(void)
+{
+	unsigned int type, i;
+	struct mb_pool_blk *blk;
+
+	for (type = 0; type < MBPOOL_MAX; type++)
+	{
+		mbpool_free[type] = NULL;
+		blk = (struct mb_pool_blk *)mbpool_base[type];
+
+		for (i = 0; i < mbpool_num[type]; i++)
+		{
+			blk->next = mbpool_free[type];
+			mbpool_free[type] = blk;
+			blk = (struct mb_pool_blk *)((unsigned char *)blk + mbpool_size[type]);
+		}
+
+		mbpool_stats[type].name  = mbpool_name[type];
+		mbpool_stats[type].size  = mbpool_size[type];
+		mbpool_stats[type].avail = mbpool_num[type];
+		mbpool_stats[type].used  = 0;
+		mbpool_stats[type].max   = 0;
+		mbpool_stats[type].err   = 0;
+	}
+}
+
+/**
+*从指定内存池中分配一个块
+*type:内存池编号
+*返回值：成功则返回块地址，内存池已耗尽则返回NULL并记录分配失败次数
+*/
+void *ModbusPoolAlloc(eMBPoolType type)
+{
+	struct mb_pool_blk *blk;
+	SYS_ARCH_DECL_PROTECT(lev);
+
+	SYS_ARCH_PROTECT(lev);
+
+	blk = mbpool_free[type];
+	if (blk != NULL)
+	{
+		mbpool_free[type] = blk->next;
+		mbpool_stats[type].used++;
+		if (mbpool_stats[type].used > mbpool_stats[type].max)
+		{
+			mbpool_stats[type].max = mbpool_stats[type].used;    //更新高水位
+		}
+	}
+	else
+	{
+		mbpool_stats[type].err++;
+	}
+
+	SYS_ARCH_UNPROTECT(lev);
+
+	return (void *)blk;
+}
+
+/**
+*将块归还到指定内存池
+*type:内存池编号；mem:由ModbusPoolAlloc分配的块地址，为NULL时不做处理
+*/
+void ModbusPoolFree(eMBPoolType type, void *mem)
+{
+	struct mb_pool_blk *blk = (struct mb_pool_blk *)mem;
+	SYS_ARCH_DECL_PROTECT(lev);
+
+	if (blk == NULL)
+	{
+		return;
+	}
+
+	SYS_ARCH_PROTECT(lev);
+	blk->next = mbpool_free[type];
+	mbpool_free[type] = blk;
+	mbpool_stats[type].used--;
+	SYS_ARCH_UNPROTECT(lev);
+}
+
+//读取指定内存池的统计信息（块总数、当前用量、高水位、分配失败次数）
+void ModbusPoolStats(eMBPoolType type, mb_pool_stats_t *stats)
+{
+	SYS_ARCH_DECL_PROTECT(lev);
+
+	SYS_ARCH_PROTECT(lev);
+	*stats = mbpool_stats[type];
+	SYS_ARCH_UNPROTECT(lev);
+}
+
+//获得块在内存池中的序号（0 ~ 块数量-1），可用于索引与块一一对应的其他资源
+unsigned int ModbusPoolIndex(eMBPoolType type, const void *mem)
+{
+	return ((const unsigned char *)mem - mbpool_base[type]) / mbpool_size[type];
+}
@@ -0,0 +1,99 @@
+#ifndef __MB_POOL_H__
+#define __MB_POOL_H__
+
+/**
+*Modbus服务器/网关使用的静态内存池。
+*各类对象的块大小和块数量在编译期确定，存储区为静态数组，运行期间不再向堆申请内存，
+*避免网关长时间运行后出现堆碎片和分配延时抖动。空闲块以单链表串起，分配取表头、
+*释放插回表头，两者均为O(1)操作。
+*
+*注：netconn和netbuf由lwip自身的memp内存池分配（lwipopts.h中MEMP_MEM_MALLOC为0时），
+*其数量由MEMP_NUM_NETCONN、MEMP_NUM_NETBUF配置，用量可打开MEMP_STATS后查看。
+**/
+
+#include "modbus_tcp.h"
+
+struct netconn;
+
+//各内存池块数量，可在编译时覆盖
+#ifndef MBPOOL_CONN_NUM
+#define  MBPOOL_CONN_NUM    MAX_CLIENT_NUM    //连接上下文数量，每个子任务堆栈区对应一个
+#endif
+
+#if MBPOOL_CONN_NUM < MAX_CLIENT_NUM
+#error "MBPOOL_CONN_NUM must not be less than MAX_CLIENT_NUM"
+#endif
+
+#ifndef MBPOOL_FRAME_NUM
+#define  MBPOOL_FRAME_NUM   8        //请求/响应帧数量，转发到下游Modbus/TCP设备的每个挂起请求占用一个
+#endif
+
+#ifndef MBPOOL_TRANS_NUM
+#define  MBPOOL_TRANS_NUM   8        //挂起的总线事务数量，用法同上（RS485由usart_sem串行化，无需事务对象）
+#endif
+
+//Modbus/TCP最大帧长度
+#define  MBPOOL_FRAME_SIZE  (256+7)
+
+//客户端连接上下文，在连接建立时分配，子任务退出时释放
+typedef struct mb_conn
+{
+	struct netconn *conn;            //对应客户端的连接结构
+	unsigned int    index;           //子任务堆栈区索引
+	unsigned int    last_active;     //最近一次收到请求的时刻（系统节拍）
+	volatile unsigned char evict;    //为1时表示连接已被淘汰，子任务应尽快关闭连接并退出
+}mb_conn_t;
+
+//Modbus/TCP请求或响应帧
+typedef struct mb_frame
+{
+	unsigned short len;              //帧长度
+	unsigned char  buf[MBPOOL_FRAME_SIZE];
+}mb_frame_t;
+
+//挂起的总线事务，从请求发出到收到响应（或超时）期间有效
+typedef struct mb_trans
+{
+	struct netconn *conn;            //发起事务的客户端连接
+	unsigned short  tid;             //事务标识符
+	unsigned char   uid;             //单元标识符
+	unsigned char   func;            //功能码
+	unsigned int    start;           //事务开始时刻（系统节拍）
+	unsigned short  up_tid;          //转发到下游Modbus/TCP设备时改写后的事务标识符
+	mb_frame_t     *frame;           //转发的请求帧，收到下游响应后存放响应帧
+	void           *upstream;        //转发所用的下游连接
+}mb_trans_t;
+
+//内存池配置表：编号、名称、块大小、块数量
+#define  MBPOOL_TABLE(X) \
+	X(MBPOOL_CONN,  "conn",  sizeof(mb_conn_t),  MBPOOL_CONN_NUM)  \
+	X(MBPOOL_FRAME, "frame", sizeof(mb_frame_t), MBPOOL_FRAME_NUM) \
+	X(MBPOOL_TRANS, "trans", sizeof(mb_trans_t), MBPOOL_TRANS_NUM)
+
+#define  MBPOOL_ENUM(id, name, size, num)  id,
+
+//内存池编号
+typedef enum
+{
+	MBPOOL_TABLE(MBPOOL_ENUM)
+	MBPOOL_MAX
+}eMBPoolType;
+
+//内存池统计信息，用于根据实测数据确定RAM配置
+typedef struct mb_pool_stats
+{
+	const char    *name;             //内存池名称
+	unsigned short size;             //块大小（对齐后）
+	unsigned short avail;            //块总数
+	unsigned short used;             //当前已分配块数
+	unsigned short max;              //已分配块数的高水位
+	unsigned int   err;              //分配失败次数
+}mb_pool_stats_t;
+
+void  ModbusPoolInit(void);
+void *ModbusPoolAlloc(eMBPoolType type);
+void  ModbusPoolFree(eMBPoolType type, void *mem);
+void  ModbusPoolStats(eMBPoolType type, mb_pool_stats_t *stats);
+unsigned int ModbusPoolIndex(eMBPoolType type, const void *mem);
+
+#endif /* __MB_POOL_H__ */
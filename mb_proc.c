@@ -0,0 +1,133 @@
+/*
+*Modbus/TCP从站请求处理核心的实现。
+*
+*处理流程按照Modbus/TCP请求帧格式解析数据包，获得其中的功能码字段，回调FreeModbus应用层的
+*功能码处理函数，并根据函数执行结果构造响应帧。请求帧和响应帧使用同一缓冲区，由调用者提供，
+*因此本文件可以被多个任务/线程同时调用（功能码处理函数所访问的寄存器等应用数据除外）。
+*/
+
+#include <stddef.h>
+#include "mb.h"
+#include "mbconfig.h"
+#include "mbframe.h"
+#include "mbproto.h"
+#include "mb_proc.h"
+
+//FreeModbus中对应的功能码处理回调函数（处理Modbus PDU）
+extern xMBFunctionHandler xFuncHandlers[MB_FUNC_HANDLERS_MAX];
+
+eMBServerErrorCode ModbusFrameProcess(UCHAR *frame, USHORT len, USHORT *rsplen)
+{
+	unsigned int i;
+	eMBServerErrorCode processflag = MBS_ERROK;
+
+	eMBException eException;        //功能码回调函数执行结果
+	unsigned char  *ucMBFrame;      //Modbus PDU起始地址
+
+	//MBAP帧头各个字段值
+	unsigned int usPID;             //PID
+	unsigned short usLength;        //LEN
+	unsigned char usUID;            //UID
+	unsigned char ucFunctionCode;   //FUNC
+
+	*rsplen = 0;
+
+	do
+	{
+		//滤除长度不合法的请求
+		if (len > MB_MAX_BUF_SIZE || len < LWIP_TCP_FUNC)
+		{
+			processflag = MBS_BADREQUEST;
+			break;
+		}
+
+		//获得请求中MBAP各字段，
+		usPID = (frame[LWIP_TCP_PID] << 8U) + frame[LWIP_TCP_PID+1];        //2个字节
+		usLength = (frame[LWIP_TCP_LEN] << 8U) + frame[LWIP_TCP_LEN+1];     //2个字节
+		usUID = frame[LWIP_TCP_UID];             //1个字节
+		ucFunctionCode = frame[LWIP_TCP_FUNC];   //1个字节
+
+		//获得Modb PDU起始地址
+		ucMBFrame = &frame[LWIP_TCP_FUNC];
+
+		//对PID和LEN进行验证，LWIP_TCP_UID为6，6个字节，2字节事务标识符+2字节协议标识符+2字节长度
+		if (usPID != MODBUSTCP_PROTOCOL_ID || (usLength + LWIP_TCP_UID) != len)
+		{
+			processflag = MBS_BADPROCTOL;
+			break;
+		}
+
+		usLength--;     //得到Modbus PDU的长度
+
+		eException = MB_EX_ILLEGAL_FUNCTION;		//功能码回调函数执行结果
+		for (i = 0; i < MB_FUNC_HANDLERS_MAX; i++)
+		{
+			//根据功能码查找对应的功能码处理回调函数
+			if (xFuncHandlers[i].ucFunctionCode == 0 || xFuncHandlers[i].pxHandler == NULL)
+			{
+				processflag = MBS_ERRFUNC;
+				break;
+			}
+			else if(xFuncHandlers[i].ucFunctionCode == ucFunctionCode)
+			{
+				//调用功能码回调函数，处理Modbus PDU
+				//pxHander处理结束后，会生成Modb PDU响应，响应结果存储在ucMBFrame中，
+				//并且usLength返回了响应的长度
+				eException = xFuncHandlers[i].pxHandler(ucMBFrame,&usLength);
+				break;
+			}
+		}
+
+		//如果功能码未注册，则设置错误标志
+		if (i == MB_FUNC_HANDLERS_MAX)
+		{
+			processflag = MBS_ERRFUNC;
+		}
+		if (processflag == MBS_ERRFUNC)
+		{
+			break;
+		}
+
+		//此时，Modbus PDU处理完毕，对于广播地址，不返回任何结果
+		if (usUID == MB_ADDRESS_BROADCAST)
+		{
+			break;
+		}
+
+		//注：当服务器响应客户机时，它可以使用PDU的功能码字段来表示正常响应（无差错执行）
+		//还是异常响应（出现某种异常或错误）。对于正常响应而言，服务器响应包中的功能码字段只是简单的复制
+		//客户端请求包中的功能码；而对于异常响应来说，服务器会将客户端请求中的功能码最高有效位置为1后返回，
+		//同时响应包鞋到了异常吗，用户指明差错的类型。
+		//01 :不支持该功能码  02：越界 03：寄存器数量超出范围 04：读写错误
+
+		//若处理Modbus PDU出现错误，则构造异常响应帧
+		if (eException != MB_EX_NONE)
+		{
+			//将Modbus PDU中的功能码最高位置1
+			usLength = 0;
+			ucMBFrame[usLength++] = (UCHAR)(ucFunctionCode | MB_FUNC_ERROR);
+
+			//数据区域中携带相关错误码
+			ucMBFrame[usLength++] = eException;
+		}
+
+		//注意：ucMBFrame是指向Modbus PDU首地址，其指向的内容被包含在frame[]中，
+		//故返回frame时，ucMBFrame所指向的内容也被一起返回
+
+		//调整Modbus PDU的LEN字段
+		frame[LWIP_TCP_LEN] = (usLength + 1) >> 8U;
+		frame[LWIP_TCP_LEN + 1] = (usLength + 1) & 0xFF;
+
+		*rsplen = usLength + LWIP_TCP_FUNC;
+
+	}while(0);
+
+	return processflag;
+}
+
+
+//注：功能码处理函数xFuncHandlers是在移植FreeModbus中完成的，它为每个对应的功能码定义了一个回调函数，
+//例如控制线圈状态、控制阀门状态等。ModbusFrameProcess本质工作就是根据功能码查找相关的回调函数来处理
+//Modbus PDU
+//其中FC3/FC4/FC6/FC16等寄存器类功能码最终通过eMBRegHoldingCB、eMBRegInputCB访问寄存器，
+//这两个回调函数在mb_regbank.c中实现，多寄存器读写按字批量完成字节序转换
@@ -0,0 +1,44 @@
+#ifndef __MB_PROC_H__
+#define __MB_PROC_H__
+
+/**
+*Modbus/TCP从站请求处理核心：校验MBAP帧头，按功能码调用FreeModbus的xFuncHandlers处理PDU，
+*并在同一缓冲区中构造响应帧。该部分与网络协议栈、操作系统无关，也不使用任何全局缓冲区，
+*lwIP服务器（modbus_p.c）和Linux epoll服务器（modbus_epoll.c）共用这部分代码。
+**/
+
+#include "mb.h"
+
+//Modbus/TCP最大帧长度
+#define  MB_MAX_BUF_SIZE  (256+7)
+
+//MBAP帧头各字段的偏移值
+#ifndef LWIP_TCP_TID
+#define  LWIP_TCP_TID    0       //事务标识符
+#define  LWIP_TCP_PID    2       //协议标识符
+#define  LWIP_TCP_LEN    4       //长度
+#define  LWIP_TCP_UID    6       //设备标识符
+#define  LWIP_TCP_FUNC   7       //功能码
+
+#define  MODBUSTCP_PROTOCOL_ID    0     //协议标识符， 0 = Modbus协议
+#endif
+
+//服务器内部处理错误码
+typedef enum
+{
+	MBS_ERROK,       //无错误
+	MBS_BADREQUEST,  //请求不完整
+	MBS_BADPROCTOL,  //协议验证失败
+	MBS_ERRFUNC,     //功能码错误
+	MBS_ERRSEND,     //返回数据失败
+}eMBServerErrorCode;
+
+/**
+*处理一个完整的Modbus/TCP请求帧，响应帧直接写回frame
+*frame:请求帧，缓冲区长度至少为MB_MAX_BUF_SIZE；len:请求帧长度
+*rsplen:返回响应帧长度，广播请求不需要响应，返回0
+*返回值：正确处理则返回MBS_ERROK（包括返回异常响应的情况），否则返回错误值，此时不应返回响应
+*/
+eMBServerErrorCode ModbusFrameProcess(UCHAR *frame, USHORT len, USHORT *rsplen);
+
+#endif /* __MB_PROC_H__ */
@@ -0,0 +1,228 @@
+/*
+*从站服务器寄存器库的实现，即移植FreeModbus时需要用户提供的寄存器回调函数。
+*
+*Modbus PDU中的寄存器值为大端字节序，寄存器库中为主机字节序。读寄存器时需将寄存器库
+*中的值逐个转换为大端后写入PDU，写寄存器时反之。在小端CPU上，一次读出32位字（两个寄存器），
+*交换每个半字内的两个字节即可同时完成两个寄存器的转换，GCC/ARMCC在Cortex-M3/M4上会将
+*该表达式编译为一条REV16指令；在大端CPU上则无需转换，直接拷贝即可。
+*/
+
+#include <string.h>
+#include "lwip/arch.h"
+#include "mb.h"
+#include "mb_regbank.h"
+#include "mb_writeback.h"
+#include "mb_stats.h"
+
+//寄存器库存储区
+MB_REGBANK_ALIGN USHORT usRegHoldingBuf[MB_REG_HOLDING_NREGS];
+MB_REGBANK_ALIGN USHORT usRegInputBuf[MB_REG_INPUT_NREGS];
+
+//计算型寄存器表项
+typedef struct mb_reg_computed
+{
+	UCHAR           ucType;      //寄存器类型
+	USHORT          usStart;     //起始地址
+	USHORT          usNRegs;     //寄存器数量
+	pxMBRegComputed pxHandler;   //回调函数
+}mb_reg_computed_t;
+
+#define  MB_REG_COMPUTED_DECL(type, start, nregs, handler) \
+	extern eMBErrorCode handler(USHORT usAddress, USHORT *pusValue, eMBRegisterMode eMode);
+#define  MB_REG_COMPUTED_ENTRY(type, start, nregs, handler) \
+	{ (type), (start), (nregs), handler },
+
+MB_REG_COMPUTED_TABLE(MB_REG_COMPUTED_DECL)
+
+//计算型寄存器表，最后一项为结束标志
+static const mb_reg_computed_t xRegComputed[] =
+{
+	MB_REG_COMPUTED_TABLE(MB_REG_COMPUTED_ENTRY)
+	{ 0, 0, 0, NULL }
+};
+
+#define  MB_REG_COMPUTED_NUM  (sizeof(xRegComputed) / sizeof(xRegComputed[0]) - 1)
+
+//交换32位字中两个半字各自的高低字节
+#define  MB_REG_SWAP16X2(w)   ((((w) & 0x00FF00FFUL) << 8) | (((w) >> 8) & 0x00FF00FFUL))
+
+//将n个寄存器从寄存器库拷贝到PDU中，并转换为大端字节序
+static void ModbusRegPack(UCHAR *pucDst, const USHORT *pusSrc, USHORT usNRegs)
+{
+#if BYTE_ORDER == BIG_ENDIAN
+	memcpy(pucDst, pusSrc, usNRegs * 2);
+#else
+	u32_t w;
+
+	//每次处理两个寄存器，PDU中的地址可能是奇地址，用memcpy完成非对齐访问
+	while (usNRegs >= 2)
+	{
+		memcpy(&w, pusSrc, 4);
+		w = MB_REG_SWAP16X2(w);
+		memcpy(pucDst, &w, 4);
+		pusSrc += 2;
+		pucDst += 4;
+		usNRegs -= 2;
+	}
+
+	if (usNRegs)
+	{
+		*pucDst++ = (UCHAR)(*pusSrc >> 8);
+		*pucDst   = (UCHAR)(*pusSrc & 0xFF);
+	}
+#endif
+}
+
+//将n个寄存器从PDU拷贝到寄存器库中，并转换为主机字节序
+static void ModbusRegUnpack(USHORT *pusDst, const UCHAR *pucSrc, USHORT usNRegs)
+{
+#if BYTE_ORDER == BIG_ENDIAN
+	memcpy(pusDst, pucSrc, usNRegs * 2);
+#else
+	u32_t w;
+
+	while (usNRegs >= 2)
+	{
+		memcpy(&w, pucSrc, 4);
+		w = MB_REG_SWAP16X2(w);
+		memcpy(pusDst, &w, 4);
+		pucSrc += 4;
+		pusDst += 2;
+		usNRegs -= 2;
+	}
+
+	if (usNRegs)
+	{
+		*pusDst = (USHORT)((pucSrc[0] << 8) | pucSrc[1]);
+	}
+#endif
+}
+
+//查找覆盖指定寄存器的计算型寄存器表项，未找到返回NULL
+static const mb_reg_computed_t *ModbusRegComputedFind(UCHAR ucType, USHORT usAddress)
+{
+	unsigned int i;
+
+	for (i = 0; i < MB_REG_COMPUTED_NUM; i++)
+	{
+		if (xRegComputed[i].ucType == ucType
+			&& usAddress >= xRegComputed[i].usStart
+			&& usAddress < xRegComputed[i].usStart + xRegComputed[i].usNRegs)
+		{
+			return &xRegComputed[i];
+		}
+	}
+
+	return NULL;
+}
+
+//判断地址区间内是否含有计算型寄存器
+static BOOL ModbusRegHasComputed(UCHAR ucType, USHORT usAddress, USHORT usNRegs)
+{
+	unsigned int i;
+
+	for (i = 0; i < MB_REG_COMPUTED_NUM; i++)
+	{
+		if (xRegComputed[i].ucType == ucType
+			&& usAddress < xRegComputed[i].usStart + xRegComputed[i].usNRegs
+			&& xRegComputed[i].usStart < usAddress + usNRegs)
+		{
+			return TRUE;
+		}
+	}
+
+	return FALSE;
+}
+
+/**
+*读写寄存器库中的一段寄存器
+*ucType:寄存器类型；pusBank:寄存器库；usIndex:起始寄存器在库中的下标
+*pucRegBuffer:PDU中的寄存器数据；usAddress:起始寄存器地址；usNRegs:寄存器数量
+*返回值：正确处理则返回MB_ENOERR，否则返回计算型寄存器回调的错误值
+*/
+static eMBErrorCode ModbusRegAccess(UCHAR ucType, USHORT *pusBank, USHORT usIndex,
+									UCHAR *pucRegBuffer, USHORT usAddress, USHORT usNRegs,
+									eMBRegisterMode eMode)
+{
+	const mb_reg_computed_t *pxComputed;
+	eMBErrorCode eStatus = MB_ENOERR;
+	USHORT usValue;
+
+	//区间内全部为普通寄存器，批量转换拷贝
+	if (!ModbusRegHasComputed(ucType, usAddress, usNRegs))
+	{
+		if (eMode == MB_REG_READ)
+		{
+			ModbusRegPack(pucRegBuffer, &pusBank[usIndex], usNRegs);
+		}
+		else
+		{
+			//只更新寄存器库，后备存储器由回写任务延迟写入
+			ModbusRegUnpack(&pusBank[usIndex], pucRegBuffer, usNRegs);
+			if (ucType == MB_REG_HOLDING)
+				ModbusWriteBackMark(usIndex, usNRegs);
+		}
+		return MB_ENOERR;
+	}
+
+	//区间内含有计算型寄存器，逐个处理
+	while (usNRegs > 0 && eStatus == MB_ENOERR)
+	{
+		pxComputed = ModbusRegComputedFind(ucType, usAddress);
+		if (eMode == MB_REG_READ)
+		{
+			if (pxComputed != NULL)
+				eStatus = pxComputed->pxHandler(usAddress, &usValue, MB_REG_READ);
+			else
+				usValue = pusBank[usIndex];
+			*pucRegBuffer++ = (UCHAR)(usValue >> 8);
+			*pucRegBuffer++ = (UCHAR)(usValue & 0xFF);
+		}
+		else
+		{
+			usValue = (USHORT)((pucRegBuffer[0] << 8) | pucRegBuffer[1]);
+			pucRegBuffer += 2;
+			if (pxComputed != NULL)
+			{
+				eStatus = pxComputed->pxHandler(usAddress, &usValue, MB_REG_WRITE);
+			}
+			else
+			{
+				pusBank[usIndex] = usValue;
+				if (ucType == MB_REG_HOLDING)
+					ModbusWriteBackMark(usIndex, 1);
+			}
+		}
+		usAddress++;
+		usIndex++;
+		usNRegs--;
+	}
+
+	return eStatus;
+}
+
+//保持寄存器回调函数，供FC3/FC6/FC16/FC23调用
+eMBErrorCode eMBRegHoldingCB(UCHAR *pucRegBuffer, USHORT usAddress, USHORT usNRegs, eMBRegisterMode eMode)
+{
+	if (usAddress < MB_REG_HOLDING_START
+		|| usAddress + usNRegs > MB_REG_HOLDING_START + MB_REG_HOLDING_NREGS)
+	{
+		return MB_ENOREG;
+	}
+
+	return ModbusRegAccess(MB_REG_HOLDING, usRegHoldingBuf, usAddress - MB_REG_HOLDING_START,
+						   pucRegBuffer, usAddress, usNRegs, eMode);
+}
+
+//输入寄存器回调函数，供FC4调用
+eMBErrorCode eMBRegInputCB(UCHAR *pucRegBuffer, USHORT usAddress, USHORT usNRegs)
+{
+	if (usAddress < MB_REG_INPUT_START
+		|| usAddress + usNRegs > MB_REG_INPUT_START + MB_REG_INPUT_NREGS)
+	{
+		return MB_ENOREG;
+	}
+
+	return ModbusRegAccess(MB_REG_INPUT, usRegInputBuf, usAddress - MB_REG_INPUT_START,
+						   pucRegBuffer, usAddress, usNRegs, MB_REG_READ);
+}
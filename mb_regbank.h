@@ -0,0 +1,72 @@
+#ifndef __MB_REGBANK_H__
+#define __MB_REGBANK_H__
+
+/**
+*从站服务器的寄存器库。保持寄存器和输入寄存器分别存放在一段连续、按缓存行对齐的
+*数组中，FreeModbus的FC3/FC4/FC6/FC16/FC23处理函数通过eMBRegHoldingCB和eMBRegInputCB
+*访问寄存器库。多寄存器读写按字（每次两个寄存器）批量完成大端字节序转换，只有被标记为
+*计算型的寄存器才逐个调用回调函数。
+**/
+
+#include "mb.h"
+
+//寄存器库的起始地址与寄存器数量，FreeModbus传入的地址从1开始
+#ifndef MB_REG_HOLDING_START
+#define  MB_REG_HOLDING_START   1
+#endif
+#ifndef MB_REG_HOLDING_NREGS
+#define  MB_REG_HOLDING_NREGS   512
+#endif
+
+#ifndef MB_REG_INPUT_START
+#define  MB_REG_INPUT_START     1
+#endif
+#ifndef MB_REG_INPUT_NREGS
+#define  MB_REG_INPUT_NREGS     512
+#endif
+
+//寄存器库按缓存行对齐
+#define  MB_REGBANK_CACHE_LINE  32
+
+#if defined(__CC_ARM)
+#define  MB_REGBANK_ALIGN       __align(MB_REGBANK_CACHE_LINE)
+#elif defined(__GNUC__)
+#define  MB_REGBANK_ALIGN       __attribute__((aligned(MB_REGBANK_CACHE_LINE)))
+#else
+#define  MB_REGBANK_ALIGN
+#endif
+
+//寄存器类型
+#define  MB_REG_HOLDING         0
+#define  MB_REG_INPUT           1
+
+/**
+*计算型寄存器的回调函数，每次只处理一个寄存器
+*usAddress:寄存器地址；pusValue:读操作时返回寄存器值，写操作时为待写入的值
+*eMode:MB_REG_READ或MB_REG_WRITE
+*/
+typedef eMBErrorCode (*pxMBRegComputed)(USHORT usAddress, USHORT *pusValue, eMBRegisterMode eMode);
+
+/**
+*计算型寄存器表：寄存器类型、起始地址、寄存器数量、回调函数。
+*表中未列出的寄存器均为普通寄存器，直接在寄存器库中读写。默认只有输入寄存器末尾的统计保留区
+*（见mb_stats.h）为计算型寄存器，可在编译时覆盖该表，例如：
+*#define MB_REG_COMPUTED_TABLE(X) \
+*	X(MB_REG_INPUT, MB_STATS_REG_START, MB_STATS_REG_NUM, ModbusStatsRegRead) \
+*	X(MB_REG_INPUT, 100, 2, ModbusUptimeRead)
+*统计寄存器依赖uC/OS的任务和节拍，Linux后端（modbus_epoll.c）默认没有计算型寄存器。
+*/
+#ifndef MB_REG_COMPUTED_TABLE
+#if defined(__linux__)
+#define  MB_REG_COMPUTED_TABLE(X)
+#else
+#define  MB_REG_COMPUTED_TABLE(X) \
+	X(MB_REG_INPUT, MB_STATS_REG_START, MB_STATS_REG_NUM, ModbusStatsRegRead)
+#endif
+#endif
+
+//寄存器库，供应用程序直接访问（主机字节序）
+extern USHORT usRegHoldingBuf[MB_REG_HOLDING_NREGS];
+extern USHORT usRegInputBuf[MB_REG_INPUT_NREGS];
+
+#endif /* __MB_REGBANK_H__ */
@@ -0,0 +1,507 @@
+/*
+*mb_replay：报文捕获回放工具，在主机（Linux等POSIX系统）上运行。
+*
+*  mb_replay fetch  <host> [port]                   从网关/从站服务器的捕获端口导出捕获环，写到标准输出
+*  mb_replay show   <file>                          列出捕获文件中的记录
+*  mb_replay replay <file> <host> [port] [speed]    按捕获时的时序向服务器重放Modbus/TCP请求
+*
+*重放时，捕获文件中每个子任务号对应一条TCP连接，各连接上的请求按原始时间戳（除以speed）发出，
+*speed为1时按原始时序，大于1时按倍速加速，为0时不等待、尽快发送。服务器逐个处理同一连接上的
+*请求，因此每条连接上同时只有一个未完成的请求，前一个请求未返回时后续请求顺延并计入发送滞后。
+*只重放客户端请求（MB_CAP_TCP_REQ），其余记录仅用于分析。广播请求不等待响应。
+*结束后输出响应数、异常响应数、超时数、响应时间分布和实际请求速率。
+*
+*编译：cc -O2 -o mb_replay mb_replay.c
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <time.h>
+#include <poll.h>
+#include <unistd.h>
+#include <netdb.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+//以下定义与mb_capture.h一致
+#define  MB_CAPTURE_PORT         5021
+#define  MB_CAPTURE_MAGIC        0x4D424350      //"MBCP"
+#define  MB_CAPTURE_VERSION      1
+#define  MB_CAPTURE_FILE_HDR     12
+#define  MB_CAPTURE_REC_HDR      8
+
+#define  MB_CAP_TCP_REQ          1
+#define  MB_CAP_TCP_RSP          2
+#define  MB_CAP_RTU_REQ          3
+#define  MB_CAP_RTU_RSP          4
+
+#define  MODBUS_TCP_PORT         502
+#define  MBAP_LEN                7               //MBAP帧头长度
+#define  REPLAY_SLOT_MAX         256             //子任务号为一个字节
+#define  REPLAY_TIMEOUT_MS       3000            //等待响应的超时时间
+#define  REPLAY_BUF_SIZE         512
+
+//捕获记录
+typedef struct
+{
+	unsigned int tick;           //时间戳，系统节拍
+	unsigned char type;          //记录类型
+	unsigned char slot;          //子任务号
+	unsigned short len;          //数据长度
+	unsigned char *data;         //数据
+}replay_rec_t;
+
+//捕获文件
+typedef struct
+{
+	unsigned int tick_rate;      //系统节拍频率
+	unsigned int dropped;        //导出期间丢弃的记录数
+	replay_rec_t *rec;
+	size_t num;
+}replay_file_t;
+
+//重放连接，对应捕获文件中的一个子任务号
+typedef struct
+{
+	int fd;
+	size_t *req;                 //该连接上的请求，记录下标
+	size_t num, next;            //请求数、下一个待发送的请求
+	int busy;                    //有未完成的请求
+	double sent;                 //未完成请求的发送时间（毫秒）
+	unsigned short tid;          //未完成请求的TID
+	unsigned char rxbuf[REPLAY_BUF_SIZE];
+	size_t rxlen;
+}replay_conn_t;
+
+//重放结果
+typedef struct
+{
+	size_t sent, responses, exceptions, timeouts, errors, mismatch;
+	double *latency;             //各请求的响应时间（毫秒）
+	double lag_max, lag_sum;     //发送相对计划时间的滞后（毫秒）
+}replay_result_t;
+
+static unsigned int get16(const unsigned char *p)
+{
+	return ((unsigned int)p[0] << 8) | p[1];
+}
+
+static unsigned int get32(const unsigned char *p)
+{
+	return ((unsigned int)p[0] << 24) | ((unsigned int)p[1] << 16) | ((unsigned int)p[2] << 8) | p[3];
+}
+
+//两个节拍时间戳之差，按有符号32位计算：节拍计数回绕时结果仍正确，早于基准的记录得到负值而不是接近2^32的数
+static int32_t tick_diff(unsigned int tick, unsigned int base)
+{
+	return (int32_t)(uint32_t)(tick - base);
+}
+
+//当前时间（毫秒）
+static double now_ms(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+}
+
+//建立TCP连接，失败返回-1
+static int tcp_connect(const char *host, const char *port)
+{
+	struct addrinfo hints, *res, *ai;
+	int fd = -1, one = 1;
+
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+	if (getaddrinfo(host, port, &hints, &res) != 0)
+	{
+		fprintf(stderr, "mb_replay: cannot resolve %s\n", host);
+		return -1;
+	}
+
+	for (ai = res; ai != NULL; ai = ai->ai_next)
+	{
+		fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+		if (fd < 0)
+			continue;
+		if (connect(fd, ai->ai_addr, ai->ai_addrlen) == 0)
+			break;
+		close(fd);
+		fd = -1;
+	}
+	freeaddrinfo(res);
+
+	if (fd < 0)
+	{
+		fprintf(stderr, "mb_replay: cannot connect to %s:%s: %s\n", host, port, strerror(errno));
+		return -1;
+	}
+
+	setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+	return fd;
+}
+
+//从捕获端口导出捕获环，原样写到标准输出
+static int replay_fetch(const char *host, const char *port)
+{
+	unsigned char buf[4096];
+	ssize_t n;
+	int fd = tcp_connect(host, port);
+
+	if (fd < 0)
+		return 1;
+
+	while ((n = recv(fd, buf, sizeof(buf), 0)) > 0)
+	{
+		if (fwrite(buf, 1, (size_t)n, stdout) != (size_t)n)
+		{
+			perror("mb_replay: write");
+			close(fd);
+			return 1;
+		}
+	}
+	close(fd);
+
+	if (n < 0)
+	{
+		perror("mb_replay: recv");
+		return 1;
+	}
+	return 0;
+}
+
+//读入捕获文件，末尾不完整的记录被忽略
+static int replay_load(const char *path, replay_file_t *file)
+{
+	FILE *fp = fopen(path, "rb");
+	unsigned char hdr[MB_CAPTURE_FILE_HDR];
+	replay_rec_t rec;
+	size_t cap = 0;
+
+	memset(file, 0, sizeof(*file));
+	if (fp == NULL)
+	{
+		perror(path);
+		return -1;
+	}
+
+	if (fread(hdr, 1, MB_CAPTURE_FILE_HDR, fp) != MB_CAPTURE_FILE_HDR
+		|| get32(hdr) != MB_CAPTURE_MAGIC || hdr[4] != MB_CAPTURE_VERSION || get16(&hdr[6]) == 0)
+	{
+		fprintf(stderr, "%s: not a capture file\n", path);
+		fclose(fp);
+		return -1;
+	}
+	file->tick_rate = get16(&hdr[6]);
+	file->dropped = get32(&hdr[8]);
+
+	while (fread(hdr, 1, MB_CAPTURE_REC_HDR, fp) == MB_CAPTURE_REC_HDR)
+	{
+		rec.len = (unsigned short)get16(hdr);
+		rec.type = hdr[2];
+		rec.slot = hdr[3];
+		rec.tick = get32(&hdr[4]);
+		rec.data = malloc(rec.len ? rec.len : 1);
+		if (rec.data == NULL || fread(rec.data, 1, rec.len, fp) != rec.len)
+		{
+			free(rec.data);
+			break;
+		}
+
+		if (file->num == cap)
+		{
+			cap = cap ? cap * 2 : 256;
+			file->rec = realloc(file->rec, cap * sizeof(replay_rec_t));
+			if (file->rec == NULL)
+			{
+				fprintf(stderr, "mb_replay: out of memory\n");
+				exit(1);
+			}
+		}
+		file->rec[file->num++] = rec;
+	}
+
+	fclose(fp);
+	return 0;
+}
+
+//列出捕获文件中的记录
+static int replay_show(const char *path)
+{
+	static const char *type_name[] = {"?", "TCP-REQ", "TCP-RSP", "RTU-REQ", "RTU-RSP"};
+	replay_file_t file;
+	replay_rec_t *rec;
+	size_t i, j;
+
+	if (replay_load(path, &file) != 0)
+		return 1;
+
+	printf("# %zu records, tick rate %u Hz, %u dropped during dump\n", file.num, file.tick_rate, file.dropped);
+	for (i = 0; i < file.num; i++)
+	{
+		rec = &file.rec[i];
+		printf("%12.3f  slot %-3u %-7s %3u:", (double)tick_diff(rec->tick, file.rec[0].tick) / file.tick_rate,
+			rec->slot, type_name[rec->type <= MB_CAP_RTU_RSP ? rec->type : 0], rec->len);
+		for (j = 0; j < rec->len; j++)
+			printf(" %02x", rec->data[j]);
+		printf("\n");
+	}
+	return 0;
+}
+
+static int cmp_double(const void *a, const void *b)
+{
+	double x = *(const double *)a, y = *(const double *)b;
+
+	return (x > y) - (x < y);
+}
+
+//处理连接上收到的数据，每收齐一个完整的响应结束一个请求
+static void replay_input(replay_conn_t *c, replay_result_t *res, double now)
+{
+	size_t flen;
+
+	while (c->busy && c->rxlen >= MBAP_LEN - 1)
+	{
+		flen = 6 + get16(&c->rxbuf[4]);
+		if (flen > sizeof(c->rxbuf))
+		{
+			res->errors++;          //帧长度错误，丢弃已收到的数据
+			c->rxlen = 0;
+			return;
+		}
+		if (c->rxlen < flen)
+			return;
+
+		if (get16(c->rxbuf) != c->tid)
+			res->mismatch++;
+		if (flen > MBAP_LEN && (c->rxbuf[MBAP_LEN] & 0x80))
+			res->exceptions++;
+		res->latency[res->responses++] = now - c->sent;
+		c->busy = 0;
+
+		memmove(c->rxbuf, c->rxbuf + flen, c->rxlen - flen);
+		c->rxlen -= flen;
+	}
+}
+
+//按捕获时序重放客户端请求
+static int replay_run(const char *path, const char *host, const char *port, double speed)
+{
+	replay_file_t file;
+	replay_conn_t *conn[REPLAY_SLOT_MAX] = {0};
+	replay_conn_t *c;
+	replay_result_t res;
+	replay_rec_t *rec;
+	struct pollfd pfd[REPLAY_SLOT_MAX];
+	replay_conn_t *pconn[REPLAY_SLOT_MAX];
+	unsigned int tick0 = 0;
+	double start, now, due, wake, elapsed;
+	size_t i, total = 0, done;
+	int s, n, nconn = 0, timeout;
+	ssize_t r;
+
+	if (replay_load(path, &file) != 0)
+		return 1;
+
+	//按子任务号把请求分配到各连接
+	for (i = 0; i < file.num; i++)
+	{
+		rec = &file.rec[i];
+		if (rec->type != MB_CAP_TCP_REQ || rec->len < MBAP_LEN)
+			continue;
+
+		if (total++ == 0)
+			tick0 = rec->tick;
+
+		c = conn[rec->slot];
+		if (c == NULL)
+		{
+			c = conn[rec->slot] = calloc(1, sizeof(replay_conn_t));
+			c->req = malloc(file.num * sizeof(size_t));
+			c->fd = tcp_connect(host, port);
+			if (c->fd < 0)
+				return 1;
+			nconn++;
+		}
+		c->req[c->num++] = i;
+	}
+
+	if (total == 0)
+	{
+		fprintf(stderr, "%s: no Modbus/TCP requests to replay\n", path);
+		return 1;
+	}
+
+	memset(&res, 0, sizeof(res));
+	res.latency = malloc(total * sizeof(double));
+
+	start = now_ms();
+	done = 0;
+	while (done < total)
+	{
+		now = now_ms();
+		wake = now + REPLAY_TIMEOUT_MS;
+		n = 0;
+
+		for (s = 0; s < REPLAY_SLOT_MAX; s++)
+		{
+			c = conn[s];
+			if (c == NULL)
+				continue;
+
+			//响应超时，重新建立连接，避免迟到的响应被当作下一个请求的响应
+			if (c->busy && now - c->sent >= REPLAY_TIMEOUT_MS)
+			{
+				res.timeouts++;
+				c->busy = 0;
+				c->rxlen = 0;
+				close(c->fd);
+				c->fd = tcp_connect(host, port);
+				if (c->fd < 0)
+					return 1;
+			}
+
+			//到了计划时间则发出下一个请求
+			if (!c->busy && c->next < c->num)
+			{
+				rec = &file.rec[c->req[c->next]];
+				due = speed > 0 ? (double)tick_diff(rec->tick, tick0) * 1000.0 / file.tick_rate / speed : 0;
+				if (start + due <= now)
+				{
+					if (now - start - due > res.lag_max)
+						res.lag_max = now - start - due;
+					res.lag_sum += now - start - due;
+
+					c->next++;
+					done++;
+					res.sent++;
+					if (send(c->fd, rec->data, rec->len, 0) != (ssize_t)rec->len)
+					{
+						res.errors++;
+					}
+					else if (rec->data[6] != 0)      //广播请求没有响应
+					{
+						c->busy = 1;
+						c->sent = now;
+						c->tid = (unsigned short)get16(rec->data);
+					}
+				}
+				else if (start + due < wake)
+				{
+					wake = start + due;
+				}
+			}
+
+			if (c->busy)
+			{
+				if (c->sent + REPLAY_TIMEOUT_MS < wake)
+					wake = c->sent + REPLAY_TIMEOUT_MS;
+				pfd[n].fd = c->fd;
+				pfd[n].events = POLLIN;
+				pconn[n++] = c;
+			}
+		}
+
+		//等待响应或下一个请求的计划时间
+		if (done == total && n == 0)
+			break;
+		timeout = (int)(wake - now_ms());
+		if (timeout < 0)
+			timeout = 0;
+		if (poll(pfd, (nfds_t)n, timeout) <= 0)
+			continue;
+
+		now = now_ms();
+		for (s = 0; s < n; s++)
+		{
+			if (!(pfd[s].revents & (POLLIN | POLLERR | POLLHUP)))
+				continue;
+			c = pconn[s];
+			r = recv(c->fd, c->rxbuf + c->rxlen, sizeof(c->rxbuf) - c->rxlen, 0);
+			if (r <= 0)
+			{
+				fprintf(stderr, "mb_replay: connection closed by server\n");
+				return 1;
+			}
+			c->rxlen += (size_t)r;
+			replay_input(c, &res, now);
+		}
+	}
+
+	//等待最后一批响应
+	for (s = 0; s < REPLAY_SLOT_MAX; s++)
+	{
+		c = conn[s];
+		while (c != NULL && c->busy)
+		{
+			pfd[0].fd = c->fd;
+			pfd[0].events = POLLIN;
+			timeout = (int)(c->sent + REPLAY_TIMEOUT_MS - now_ms());
+			if (timeout <= 0 || poll(pfd, 1, timeout) <= 0
+				|| (r = recv(c->fd, c->rxbuf + c->rxlen, sizeof(c->rxbuf) - c->rxlen, 0)) <= 0)
+			{
+				res.timeouts++;
+				break;
+			}
+			c->rxlen += (size_t)r;
+			replay_input(c, &res, now_ms());
+		}
+	}
+	elapsed = now_ms() - start;
+
+	printf("capture      : %zu records, %zu requests on %d connections, %u dropped during dump\n",
+		file.num, total, nconn, file.dropped);
+	printf("replay       : speed %g, %.3f s, %.1f req/s\n", speed, elapsed / 1000.0, res.sent * 1000.0 / elapsed);
+	printf("requests     : %zu sent, %zu responses, %zu exceptions, %zu timeouts, %zu errors, %zu TID mismatches\n",
+		res.sent, res.responses, res.exceptions, res.timeouts, res.errors, res.mismatch);
+	printf("send lag     : avg %.3f ms, max %.3f ms\n", res.lag_sum / res.sent, res.lag_max);
+	if (res.responses > 0)
+	{
+		qsort(res.latency, res.responses, sizeof(double), cmp_double);
+		printf("latency (ms) : min %.3f  p50 %.3f  p90 %.3f  p99 %.3f  max %.3f\n",
+			res.latency[0], res.latency[res.responses / 2], res.latency[res.responses * 9 / 10],
+			res.latency[res.responses * 99 / 100], res.latency[res.responses - 1]);
+	}
+
+	return 0;
+}
+
+static void usage(void)
+{
+	fprintf(stderr,
+		"usage: mb_replay fetch  <host> [port]                 > capture.bin\n"
+		"       mb_replay show   <file>\n"
+		"       mb_replay replay <file> <host> [port] [speed]  (speed 1 = original timing, 0 = as fast as possible)\n");
+	exit(2);
+}
+
+int main(int argc, char *argv[])
+{
+	char port[16];
+
+	if (argc >= 3 && strcmp(argv[1], "fetch") == 0)
+	{
+		snprintf(port, sizeof(port), "%d", MB_CAPTURE_PORT);
+		return replay_fetch(argv[2], argc > 3 ? argv[3] : port);
+	}
+	if (argc == 3 && strcmp(argv[1], "show") == 0)
+	{
+		return replay_show(argv[2]);
+	}
+	if (argc >= 4 && strcmp(argv[1], "replay") == 0)
+	{
+		snprintf(port, sizeof(port), "%d", MODBUS_TCP_PORT);
+		return replay_run(argv[2], argv[3], argc > 4 ? argv[4] : port, argc > 5 ? atof(argv[5]) : 1.0);
+	}
+
+	usage();
+	return 2;
+}
@@ -0,0 +1,344 @@
+/*
+*Modbus服务器/网关运行统计的实现。
+*
+*计数器组由当前任务的优先级确定（与子任务计算堆栈区索引的方法相同）：客户端子任务对应
+*各自的堆栈区，其余任务（只有服务器主任务会记录统计）共用最后一组。每组计数器只有一个写者，
+*读者读取时可能看到正在更新中的计数，但不会看到错误的值（32位对齐读写是原子的）。
+*/
+
+#include <string.h>
+#include "lwip/sys.h"
+#include "lwip/api.h"
+#include "mb.h"
+#include "mb_regbank.h"
+#include "mb_pool.h"
+#include "modbus_tcp.h"
+#include "mb_writeback.h"
+#include "mb_stats.h"
+
+//各组累计计数，只由对应的任务写
+static u32_t stats_total[MB_STATS_SLOT_NUM][MB_STAT_MAX];
+
+//各组当前连接建立时的计数，连接级计数 = 累计计数 - 建立时计数
+static u32_t stats_conn_base[MB_STATS_SLOT_NUM][MB_STAT_CONN_NUM];
+
+//FC8清除计数器时的全局计数，诊断计数 = 全局计数 - 清除时计数
+static u32_t stats_diag_base[MB_STAT_MAX];
+
+//每秒请求数、接收字节数、发送字节数，由统计任务每秒更新一次
+static u32_t stats_req_rate, stats_rx_rate, stats_tx_rate;
+
+//FC8诊断子功能码
+#define  MB_DIAG_RETURN_QUERY        0x0000    //回送请求数据
+#define  MB_DIAG_CLEAR_COUNTERS      0x000A    //清除计数器
+#define  MB_DIAG_BUS_MSG_COUNT       0x000B    //总线报文计数
+#define  MB_DIAG_BUS_ERR_COUNT       0x000C    //总线通信错误计数
+#define  MB_DIAG_EXCEPTION_COUNT     0x000D    //异常响应计数
+#define  MB_DIAG_SERVER_MSG_COUNT    0x000E    //服务器报文计数
+#define  MB_DIAG_NO_RESPONSE_COUNT   0x000F    //服务器无响应计数
+
+//统计报文长度：报文头20字节，全局计数，各子任务的连接级计数，内存池统计，堆栈统计，回写统计
+#define  MB_STATS_PKT_SIZE  (20 + 4 * MB_STAT_MAX + 4 * MB_STATS_CLIENT_NUM * MB_STAT_CONN_NUM \
+							 + 1 + 10 * MBPOOL_MAX + 1 + 6 * (MAX_CLIENT_NUM + 1) + 20)
+
+static unsigned char stats_pkt[MB_STATS_PKT_SIZE];
+
+//由当前任务优先级得到计数器组，客户端子任务返回其堆栈区索引，其他任务返回MB_STATS_CLIENT_NUM
+unsigned int ModbusStatsSlot(void)
+{
+	unsigned int slot = (unsigned int)(OSPrioCur - MB_STATS_PRIO_BASE);
+
+	return (slot < MB_STATS_CLIENT_NUM) ? slot : MB_STATS_CLIENT_NUM;
+}
+
+//累加当前任务对应的统计项
+void ModbusStatsAdd(eMBStatId id, u32_t n)
+{
+	stats_total[ModbusStatsSlot()][id] += n;
+}
+
+//新连接开始，由客户端子任务调用，记录连接建立时的计数
+void ModbusStatsConnStart(void)
+{
+	unsigned int slot = ModbusStatsSlot();
+
+	memcpy(stats_conn_base[slot], stats_total[slot], sizeof(stats_conn_base[slot]));
+}
+
+//读取全局计数（各组计数之和）
+u32_t ModbusStatsGet(eMBStatId id)
+{
+	unsigned int slot;
+	u32_t sum = 0;
+
+	for (slot = 0; slot < MB_STATS_SLOT_NUM; slot++)
+	{
+		sum += stats_total[slot][id];
+	}
+
+	return sum;
+}
+
+//读取指定子任务上当前（或最近一次）连接的计数
+u32_t ModbusStatsConnGet(unsigned int slot, eMBStatId id)
+{
+	if (slot >= MB_STATS_CLIENT_NUM || id >= MB_STAT_CONN_NUM)
+	{
+		return 0;
+	}
+
+	return stats_total[slot][id] - stats_conn_base[slot][id];
+}
+
+//读取自上次FC8清除计数器以来的计数
+static u32_t ModbusStatsDiagGet(eMBStatId id)
+{
+	return ModbusStatsGet(id) - stats_diag_base[id];
+}
+
+/**
+*FC8诊断功能码处理函数，通过eMBRegisterCB注册到FreeModbus
+*pucFrame:Modbus PDU起始地址；usLen:PDU长度，返回响应PDU长度
+*/
+eMBException eMBFuncDiagnostics(UCHAR *pucFrame, USHORT *usLen)
+{
+	USHORT usSubFunc, usData;
+	u32_t value;
+	unsigned int id;
+
+	if (*usLen < 5)
+	{
+		return MB_EX_ILLEGAL_DATA_VALUE;
+	}
+
+	usSubFunc = (USHORT)((pucFrame[1] << 8) | pucFrame[2]);
+	usData = (USHORT)((pucFrame[3] << 8) | pucFrame[4]);
+
+	//回送请求数据，响应与请求完全相同
+	if (usSubFunc == MB_DIAG_RETURN_QUERY)
+	{
+		return MB_EX_NONE;
+	}
+
+	//其他子功能的数据域必须为0
+	if (*usLen != 5 || usData != 0)
+	{
+		return MB_EX_ILLEGAL_DATA_VALUE;
+	}
+
+	switch (usSubFunc)
+	{
+	case MB_DIAG_CLEAR_COUNTERS:
+		for (id = 0; id < MB_STAT_MAX; id++)
+		{
+			stats_diag_base[id] = ModbusStatsGet((eMBStatId)id);
+		}
+		return MB_EX_NONE;
+
+	case MB_DIAG_BUS_MSG_COUNT:
+		value = ModbusStatsDiagGet(MB_STAT_REQUEST);
+		break;
+
+	case MB_DIAG_BUS_ERR_COUNT:
+		value = ModbusStatsDiagGet(MB_STAT_ERR_BADREQUEST) + ModbusStatsDiagGet(MB_STAT_ERR_BADPROCTOL);
+		break;
+
+	case MB_DIAG_EXCEPTION_COUNT:
+		value = ModbusStatsDiagGet(MB_STAT_EXCEPTION);
+		break;
+
+	case MB_DIAG_SERVER_MSG_COUNT:
+		value = ModbusStatsDiagGet(MB_STAT_REQUEST) - ModbusStatsDiagGet(MB_STAT_ERR_BADREQUEST)
+				- ModbusStatsDiagGet(MB_STAT_ERR_BADPROCTOL);
+		break;
+
+	case MB_DIAG_NO_RESPONSE_COUNT:
+		value = ModbusStatsDiagGet(MB_STAT_NORESPONSE);
+		break;
+
+	default:
+		return MB_EX_ILLEGAL_FUNCTION;     //不支持的子功能
+	}
+
+	//诊断计数为16位
+	pucFrame[3] = (UCHAR)((value >> 8) & 0xFF);
+	pucFrame[4] = (UCHAR)(value & 0xFF);
+	*usLen = 5;
+
+	return MB_EX_NONE;
+}
+
+/**
+*输入寄存器保留区的读函数，作为计算型寄存器注册到寄存器库
+*每个全局计数占两个寄存器，高16位在前；保留区最后两个寄存器为运行时间（秒）
+*/
+eMBErrorCode ModbusStatsRegRead(USHORT usAddress, USHORT *pusValue, eMBRegisterMode eMode)
+{
+	unsigned int offset = usAddress - MB_STATS_REG_START;
+	u32_t value = 0;
+
+	if (eMode != MB_REG_READ)
+	{
+		return MB_ENOREG;
+	}
+
+	if (offset / 2 < MB_STAT_MAX)
+		value = ModbusStatsGet((eMBStatId)(offset / 2));
+	else if (offset / 2 == MB_STATS_REG_NUM / 2 - 1)
+		value = OSTimeGet() / OS_TICKS_PER_SEC;
+
+	*pusValue = (offset & 0x01) ? (USHORT)(value & 0xFFFF) : (USHORT)(value >> 16);
+
+	return MB_ENOERR;
+}
+
+//按大端字节序写入16位数
+static unsigned char *ModbusStatsPut16(unsigned char *p, u16_t value)
+{
+	*p++ = (unsigned char)(value >> 8);
+	*p++ = (unsigned char)(value);
+	return p;
+}
+
+//按大端字节序写入32位数
+static unsigned char *ModbusStatsPut32(unsigned char *p, u32_t value)
+{
+	*p++ = (unsigned char)(value >> 24);
+	*p++ = (unsigned char)(value >> 16);
+	*p++ = (unsigned char)(value >> 8);
+	*p++ = (unsigned char)(value);
+	return p;
+}
+
+/**
+*构造二进制统计报文，所有多字节字段均为大端字节序：
+*魔数(4) 版本(1) 计数器组数(1) 统计项数(1) 连接级统计项数(1) 运行时间秒(4)
+*每秒请求数(4) 每秒接收字节数(4) 每秒发送字节数(4) 全局计数(4*统计项数)
+*各子任务当前连接计数(4*连接级统计项数*子任务数)
+*内存池数(1) 各内存池（按MBPOOL_TABLE顺序）：块总数(2) 当前用量(2) 高水位(2) 分配失败次数(4)
+*堆栈数(1) 各子任务堆栈区及服务器主任务（最后一项）：大小(2) 当前使用量(2) 高水位(2)，单位为字
+*保持寄存器回写：标记次数(4) 强制合并次数(4) 写后备存储器次数(4) 失败次数(4) 脏寄存器数(2) 高水位(2)
+*/
+static u16_t ModbusStatsPack(unsigned char *pkt)
+{
+	unsigned char *p = pkt;
+	unsigned int slot, id;
+	mb_pool_stats_t pool;
+	mb_stack_usage_t stack;
+	mb_wb_stats_t wb;
+
+	p = ModbusStatsPut32(p, MB_STATS_MAGIC);
+	*p++ = MB_STATS_VERSION;
+	*p++ = MB_STATS_CLIENT_NUM;
+	*p++ = MB_STAT_MAX;
+	*p++ = MB_STAT_CONN_NUM;
+	p = ModbusStatsPut32(p, OSTimeGet() / OS_TICKS_PER_SEC);
+	p = ModbusStatsPut32(p, stats_req_rate);
+	p = ModbusStatsPut32(p, stats_rx_rate);
+	p = ModbusStatsPut32(p, stats_tx_rate);
+
+	for (id = 0; id < MB_STAT_MAX; id++)
+	{
+		p = ModbusStatsPut32(p, ModbusStatsGet((eMBStatId)id));
+	}
+
+	for (slot = 0; slot < MB_STATS_CLIENT_NUM; slot++)
+	{
+		for (id = 0; id < MB_STAT_CONN_NUM; id++)
+		{
+			p = ModbusStatsPut32(p, ModbusStatsConnGet(slot, (eMBStatId)id));
+		}
+	}
+
+	//内存池用量，用于根据实测数据确定各内存池的块数量
+	*p++ = MBPOOL_MAX;
+	for (id = 0; id < MBPOOL_MAX; id++)
+	{
+		ModbusPoolStats((eMBPoolType)id, &pool);
+		p = ModbusStatsPut16(p, pool.avail);
+		p = ModbusStatsPut16(p, pool.used);
+		p = ModbusStatsPut16(p, pool.max);
+		p = ModbusStatsPut32(p, pool.err);
+	}
+
+	//各任务堆栈使用量，用于确定CLIENT_STK_SIZE和MODBUS_SERVER_STK_SIZE
+	*p++ = MAX_CLIENT_NUM + 1;
+	for (slot = 0; slot <= MAX_CLIENT_NUM; slot++)
+	{
+		ModbusStackUsage(slot, &stack);
+		p = ModbusStatsPut16(p, stack.size);
+		p = ModbusStatsPut16(p, stack.used);
+		p = ModbusStatsPut16(p, stack.used_max);
+	}
+
+	//保持寄存器回写，网关角色下回写任务未启动，各项为0
+	ModbusWriteBackStats(&wb);
+	p = ModbusStatsPut32(p, wb.marks);
+	p = ModbusStatsPut32(p, wb.merges);
+	p = ModbusStatsPut32(p, wb.writes);
+	p = ModbusStatsPut32(p, wb.errors);
+	p = ModbusStatsPut16(p, wb.dirty);
+	p = ModbusStatsPut16(p, wb.dirty_max);
+
+	return (u16_t)(p - pkt);
+}
+
+//计算每秒速率，乘积按64位计算，避免计数增量较大时溢出
+static u32_t ModbusStatsRate(u32_t delta, INT32U ticks)
+{
+	return (u32_t)((unsigned long long)delta * OS_TICKS_PER_SEC / ticks);
+}
+
+//统计任务：每秒更新一次速率，并响应UDP统计端口上的查询
+static void ModbusStatsThread(void *arg)
+{
+	struct netconn *conn;
+	struct netbuf *inbuf, *outbuf;
+	u32_t req, rx, tx, req_last = 0, rx_last = 0, tx_last = 0;
+	INT32U now, tick_last = OSTimeGet();
+	u16_t len;
+	err_t err;
+
+	conn = netconn_new(NETCONN_UDP);
+	netconn_bind(conn, NULL, MB_STATS_PORT);
+	netconn_set_recvtimeout(conn, 1000);     //最多等待1秒，以便按时更新速率
+
+	while(1)
+	{
+		err = netconn_recv(conn, &inbuf);
+
+		now = OSTimeGet();
+		if (now - tick_last >= OS_TICKS_PER_SEC)
+		{
+			req = ModbusStatsGet(MB_STAT_REQUEST);
+			rx = ModbusStatsGet(MB_STAT_RX_BYTES);
+			tx = ModbusStatsGet(MB_STAT_TX_BYTES);
+			stats_req_rate = ModbusStatsRate(req - req_last, now - tick_last);
+			stats_rx_rate = ModbusStatsRate(rx - rx_last, now - tick_last);
+			stats_tx_rate = ModbusStatsRate(tx - tx_last, now - tick_last);
+			req_last = req;
+			rx_last = rx;
+			tx_last = tx;
+			tick_last = now;
+		}
+
+		if (err == ERR_OK)      //收到查询，将统计报文发回查询方
+		{
+			len = ModbusStatsPack(stats_pkt);
+			outbuf = netbuf_new();
+			if (outbuf != NULL)
+			{
+				netbuf_ref(outbuf, stats_pkt, len);
+				netconn_sendto(conn, outbuf, netbuf_fromaddr(inbuf), netbuf_fromport(inbuf));
+				netbuf_delete(outbuf);
+			}
+			netbuf_delete(inbuf);
+		}
+	}
+}
+
+//统计模块初始化，创建统计任务
+void ModbusStatsInit(void)
+{
+	sys_thread_new("mb_stats_thread", ModbusStatsThread, NULL, MB_STATS_THREAD_STKSIZE, MB_STATS_THREAD_PRIO);
+}
@@ -0,0 +1,83 @@
+#ifndef __MB_STATS_H__
+#define __MB_STATS_H__
+
+/**
+*Modbus服务器/网关的运行统计。
+*每个客户端子任务只写自己堆栈区对应的一组计数器，服务器主任务写另外一组，计数器不存在
+*多个写者，因此请求处理路径上无需加锁。全局计数为各组计数之和，在读取时累加。
+*统计信息可通过三种途径读取：FC8诊断子功能、输入寄存器保留区、UDP统计端口。
+*网关角色下，发往网关自身单元标识符（MB_GATE_LOCAL_UID，见tcp_rtu.h）的FC8和FC4请求由网关在本地处理，
+*其他单元标识符的请求仍转发到从站。
+**/
+
+#include "mb.h"
+#include "mb_regbank.h"
+#include "modbus_tcp.h"
+
+//计数器组数：每个客户端子任务一组，服务器主任务一组。子任务的计数器组即其堆栈区索引，
+//由当前任务优先级减去CLIENT_START_PRIO得到，两者直接取自modbus_tcp.h，保证每组只有一个写者
+#define  MB_STATS_CLIENT_NUM     MAX_CLIENT_NUM
+#define  MB_STATS_PRIO_BASE      CLIENT_START_PRIO
+#define  MB_STATS_SLOT_NUM       (MB_STATS_CLIENT_NUM + 1)
+
+//统计项，MB_STAT_CONN_NUM之前的各项同时按连接统计
+typedef enum
+{
+	MB_STAT_REQUEST = 0,         //收到的请求数
+	MB_STAT_RESPONSE,            //返回的响应数（含异常响应）
+	MB_STAT_EXCEPTION,           //异常响应数
+	MB_STAT_NORESPONSE,          //无需响应的请求数（广播）
+	MB_STAT_RX_BYTES,            //接收字节数
+	MB_STAT_TX_BYTES,            //发送字节数
+	MB_STAT_ERR_BADREQUEST,      //请求长度不合法
+	MB_STAT_ERR_BADPROCTOL,      //MBAP帧头校验失败
+	MB_STAT_ERR_FUNC,            //功能码未注册
+	MB_STAT_ERR_SEND,            //向客户端返回响应失败
+	MB_STAT_ERR_SENDRTU,         //发送RTU帧失败
+	MB_STAT_ERR_RECVRTU,         //接收RTU帧超时
+	MB_STAT_ERR_BADCRC,          //RTU帧校验失败
+	MB_STAT_ERR_NOMEM,           //事务对象或帧缓冲分配失败
+	MB_STAT_ERR_NOCONN,          //无可用的下游Modbus/TCP连接
+	MB_STAT_ERR_SENDTCP,         //向下游Modbus/TCP设备发送失败
+	MB_STAT_ERR_RECVTCP,         //等待下游Modbus/TCP设备响应超时
+	MB_STAT_IDLE_CLOSED,         //因空闲超时被关闭
+	MB_STAT_CONN_NUM,            //以上为连接级统计项
+	MB_STAT_ACCEPTED = MB_STAT_CONN_NUM,   //接受的连接数
+	MB_STAT_REFUSED,             //因资源不足被拒绝的连接数
+	MB_STAT_EVICTED,             //为新连接让位而被淘汰的连接数
+	MB_STAT_MAX
+}eMBStatId;
+
+//输入寄存器保留区：每个全局计数占两个寄存器（高16位在前），最后两个寄存器为运行时间（秒）
+#define  MB_STATS_REG_NUM        64
+#define  MB_STATS_REG_START      (MB_REG_INPUT_START + MB_REG_INPUT_NREGS - MB_STATS_REG_NUM)
+
+//UDP统计端口，收到任意数据报后返回二进制统计报文
+#ifndef MB_STATS_PORT
+#define  MB_STATS_PORT           5020
+#endif
+#define  MB_STATS_MAGIC          0x4D425354      //"MBST"
+#define  MB_STATS_VERSION        2
+
+//统计任务优先级及堆栈大小
+#ifndef MB_STATS_THREAD_PRIO
+#define  MB_STATS_THREAD_PRIO    (TCPIP_THREAD_PRIO+3)
+#endif
+#ifndef MB_STATS_THREAD_STKSIZE
+#define  MB_STATS_THREAD_STKSIZE DEFAULT_THREAD_STACKSIZE
+#endif
+
+void  ModbusStatsInit(void);
+unsigned int ModbusStatsSlot(void);
+void  ModbusStatsAdd(eMBStatId id, u32_t n);
+void  ModbusStatsConnStart(void);
+u32_t ModbusStatsGet(eMBStatId id);
+u32_t ModbusStatsConnGet(unsigned int slot, eMBStatId id);
+
+#define  ModbusStatsInc(id)      ModbusStatsAdd((id), 1)
+
+//FC8诊断功能码处理函数及统计寄存器读函数
+eMBException eMBFuncDiagnostics(UCHAR *pucFrame, USHORT *usLen);
+eMBErrorCode ModbusStatsRegRead(USHORT usAddress, USHORT *pusValue, eMBRegisterMode eMode);
+
+#endif /* __MB_STATS_H__ */
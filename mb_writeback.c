@@ -0,0 +1,300 @@
+/*
+*保持寄存器延迟回写的实现。
+*
+*脏区间表只记录寄存器库中的下标区间，不复制寄存器值，因此脏数据占用的内存是固定的。
+*回写任务每次从表中取出一段区间（最多MB_WB_BATCH_MAX个寄存器），不加锁地将其从寄存器库
+*拷贝到中转缓冲区后写入后备存储器。若拷贝期间该区间又被请求修改，修改方会在写入后重新
+*标记脏区间，新值将在下一次回写时写入，因此回写任务无需获取mem_sem。
+*/
+
+#include "lwip/sys.h"
+#include "mb.h"
+#include "mb_regbank.h"
+#include "mb_writeback.h"
+
+//脏区间，[start, end)为寄存器库下标
+typedef struct mb_wb_range
+{
+	USHORT start;
+	USHORT end;
+}mb_wb_range_t;
+
+static mb_wb_range_t wb_ranges[MB_WB_RANGE_MAX];    //脏区间表，按起始下标升序排列
+static unsigned int  wb_range_num;                  //脏区间数量
+static mb_wb_stats_t wb_stats;
+
+static sys_sem_t wb_flush_sem;     //唤醒回写任务
+static sys_sem_t wb_done_sem;      //回写任务完成同步请求
+static sys_sem_t wb_sync_lock;     //同步请求互斥量，同一时刻只处理一个同步请求
+static volatile unsigned char wb_sync_req;
+static volatile unsigned char wb_stop_req;    //停止请求，回写任务完成最后一次回写后退出
+static unsigned char wb_sem_created;
+
+//从脏区间表中删除第index项
+static void ModbusWriteBackRemove(unsigned int index)
+{
+	for (; index + 1 < wb_range_num; index++)
+	{
+		wb_ranges[index] = wb_ranges[index + 1];
+	}
+	wb_range_num--;
+}
+
+//重新统计脏寄存器数量
+static void ModbusWriteBackCount(void)
+{
+	unsigned int i;
+
+	wb_stats.dirty = 0;
+	for (i = 0; i < wb_range_num; i++)
+	{
+		wb_stats.dirty += wb_ranges[i].end - wb_ranges[i].start;
+	}
+	if (wb_stats.dirty > wb_stats.dirty_max)
+	{
+		wb_stats.dirty_max = wb_stats.dirty;
+	}
+}
+
+/**
+*标记寄存器库中被修改的区间，由寄存器回调在写入寄存器库之后调用
+*usIndex:起始寄存器在寄存器库中的下标；usNRegs:寄存器数量
+*/
+void ModbusWriteBackMark(USHORT usIndex, USHORT usNRegs)
+{
+	USHORT start = usIndex, end = usIndex + usNRegs;
+	unsigned int i, pos, nearest = 0;
+	unsigned int gap, gap_min = 0xFFFFFFFF;
+	unsigned char wakeup;
+	SYS_ARCH_DECL_PROTECT(lev);
+
+	SYS_ARCH_PROTECT(lev);
+
+	wb_stats.marks++;
+
+	//找到插入位置，第一个起始下标大于start的区间
+	for (pos = 0; pos < wb_range_num && wb_ranges[pos].start <= start; pos++);
+
+	if (wb_range_num == MB_WB_RANGE_MAX)
+	{
+		//脏区间表已满，先查看新区间与其他区间是否相交或相邻，若不相交则与距离最近的区间合并
+		for (i = 0; i < wb_range_num; i++)
+		{
+			if (start > wb_ranges[i].end)
+				gap = start - wb_ranges[i].end;
+			else if (wb_ranges[i].start > end)
+				gap = wb_ranges[i].start - end;
+			else
+				gap = 0;
+
+			if (gap < gap_min)
+			{
+				gap_min = gap;
+				nearest = i;
+			}
+		}
+
+		if (gap_min > 0)
+			wb_stats.merges++;
+
+		if (wb_ranges[nearest].start < start) start = wb_ranges[nearest].start;
+		if (wb_ranges[nearest].end > end) end = wb_ranges[nearest].end;
+		ModbusWriteBackRemove(nearest);
+		for (pos = 0; pos < wb_range_num && wb_ranges[pos].start <= start; pos++);
+	}
+
+	//插入新区间
+	for (i = wb_range_num; i > pos; i--)
+	{
+		wb_ranges[i] = wb_ranges[i - 1];
+	}
+	wb_ranges[pos].start = start;
+	wb_ranges[pos].end = end;
+	wb_range_num++;
+
+	//合并相交或相邻的区间
+	i = (pos > 0) ? pos - 1 : 0;
+	while (i + 1 < wb_range_num)
+	{
+		if (wb_ranges[i + 1].start <= wb_ranges[i].end)
+		{
+			if (wb_ranges[i + 1].end > wb_ranges[i].end)
+				wb_ranges[i].end = wb_ranges[i + 1].end;
+			ModbusWriteBackRemove(i + 1);
+		}
+		else if (i >= pos)
+		{
+			break;
+		}
+		else
+		{
+			i++;
+		}
+	}
+
+	ModbusWriteBackCount();
+	wakeup = (wb_stats.dirty > MB_WB_DIRTY_HIGH);
+
+	SYS_ARCH_UNPROTECT(lev);
+
+	//脏数据过多，提前唤醒回写任务
+	if (wakeup)
+	{
+		sys_sem_signal(&wb_flush_sem);
+	}
+}
+
+/**
+*从脏区间表头部取出一段区间，区间长度不超过MB_WB_BATCH_MAX
+*返回值：取出的寄存器数量，表为空时返回0
+*/
+static USHORT ModbusWriteBackTake(USHORT *pusIndex)
+{
+	USHORT n = 0;
+	SYS_ARCH_DECL_PROTECT(lev);
+
+	SYS_ARCH_PROTECT(lev);
+	if (wb_range_num > 0)
+	{
+		*pusIndex = wb_ranges[0].start;
+		n = wb_ranges[0].end - wb_ranges[0].start;
+		if (n > MB_WB_BATCH_MAX)
+		{
+			n = MB_WB_BATCH_MAX;
+			wb_ranges[0].start += n;
+		}
+		else
+		{
+			ModbusWriteBackRemove(0);
+		}
+		ModbusWriteBackCount();
+	}
+	SYS_ARCH_UNPROTECT(lev);
+
+	return n;
+}
+
+//将所有脏区间写入后备存储器，写入失败的区间重新标记，返回写入失败的次数
+static unsigned int ModbusWriteBackFlush(void)
+{
+	USHORT usRegs[MB_WB_BATCH_MAX];
+	USHORT usIndex, usNRegs, i;
+	unsigned int failed = 0;
+	unsigned int rounds = MB_WB_RANGE_MAX + MB_REG_HOLDING_NREGS / MB_WB_BATCH_MAX + 1;
+
+	//rounds限制单次回写的轮数，避免寄存器被持续修改时回写任务无法结束
+	while (rounds-- > 0 && (usNRegs = ModbusWriteBackTake(&usIndex)) > 0)
+	{
+		for (i = 0; i < usNRegs; i++)
+		{
+			usRegs[i] = usRegHoldingBuf[usIndex + i];
+		}
+
+		wb_stats.writes++;
+		if (eMBRegHoldingStore(MB_REG_HOLDING_START + usIndex, usRegs, usNRegs) != MB_ENOERR)
+		{
+			wb_stats.errors++;
+			failed++;
+			ModbusWriteBackMark(usIndex, usNRegs);
+			break;        //后备存储器出错，等待下一个周期再重试
+		}
+	}
+
+	return failed;
+}
+
+//回写任务，周期性地或被唤醒时将脏区间写入后备存储器
+static void ModbusWriteBackThread(void *arg)
+{
+	unsigned char sync, stop;
+	SYS_ARCH_DECL_PROTECT(lev);
+
+	while(1)
+	{
+		sys_arch_sem_wait(&wb_flush_sem, MB_WB_FLUSH_INTERVAL);    //等待回写周期到达或被唤醒
+
+		//先取走同步请求再回写，保证请求之前写入的寄存器都包含在本次回写中。
+		//读取和清零必须在同一临界区内完成，否则期间到达的同步请求会被清掉，请求方永远等不到完成信号
+		SYS_ARCH_PROTECT(lev);
+		sync = wb_sync_req;
+		wb_sync_req = 0;
+		stop = wb_stop_req;
+		SYS_ARCH_UNPROTECT(lev);
+
+		ModbusWriteBackFlush();
+
+		//有同步或停止请求，回写结束后通知请求方
+		if (sync || stop)
+		{
+			sys_sem_signal(&wb_done_sem);
+		}
+		if (stop)
+		{
+			break;
+		}
+	}
+}
+
+/**
+*同步点：阻塞直到此前所有写入的寄存器都已写入后备存储器（或写入失败），
+*可用于掉电保存、固件升级前等场合。不能在回写任务自身中调用
+*/
+void ModbusWriteBackSync(void)
+{
+	SYS_ARCH_DECL_PROTECT(lev);
+
+	sys_sem_wait(&wb_sync_lock);
+	SYS_ARCH_PROTECT(lev);
+	wb_sync_req = 1;
+	SYS_ARCH_UNPROTECT(lev);
+	sys_sem_signal(&wb_flush_sem);
+	sys_sem_wait(&wb_done_sem);
+	sys_sem_signal(&wb_sync_lock);
+}
+
+//读取回写统计信息
+void ModbusWriteBackStats(mb_wb_stats_t *stats)
+{
+	SYS_ARCH_DECL_PROTECT(lev);
+
+	SYS_ARCH_PROTECT(lev);
+	*stats = wb_stats;
+	SYS_ARCH_UNPROTECT(lev);
+}
+
+//回写模块初始化，创建回写任务
+void ModbusWriteBackInit(void)
+{
+	wb_range_num = 0;
+	wb_sync_req = 0;
+	wb_stop_req = 0;
+
+	//信号量只创建一次，停止后重新启动时继续使用
+	if (!wb_sem_created)
+	{
+		sys_sem_new(&wb_flush_sem, 0);
+		sys_sem_new(&wb_done_sem, 0);
+		sys_sem_new(&wb_sync_lock, 1);
+		wb_sem_created = 1;
+	}
+
+	sys_thread_new("mb_writeback_thread", ModbusWriteBackThread, NULL, MB_WB_THREAD_STKSIZE, MB_WB_THREAD_PRIO);
+}
+
+/**
+*停止回写任务：将剩余的脏区间写入后备存储器后回写任务退出，之后可再次调用ModbusWriteBackInit。
+*调用前应先停止所有会写寄存器的服务器。回写任务以函数返回的方式退出，只适用于允许线程函数返回的
+*移植层（如Linux下的epoll服务器），uC/OS下的任务不能返回，不要调用
+*/
+void ModbusWriteBackStop(void)
+{
+	SYS_ARCH_DECL_PROTECT(lev);
+
+	sys_sem_wait(&wb_sync_lock);
+	SYS_ARCH_PROTECT(lev);
+	wb_stop_req = 1;
+	SYS_ARCH_UNPROTECT(lev);
+	sys_sem_signal(&wb_flush_sem);
+	sys_sem_wait(&wb_done_sem);
+	sys_sem_signal(&wb_sync_lock);
+}
@@ -0,0 +1,64 @@
+#ifndef __MB_WRITEBACK_H__
+#define __MB_WRITEBACK_H__
+
+/**
+*保持寄存器的延迟回写。FC6/FC16写请求只更新内存中的寄存器库并立即应答客户端，
+*被修改的寄存器区间记录在有界的脏区间表中，由后台回写任务定期合并成批写入
+*后备存储器（Flash/EEPROM/外设），写后备存储器时不占用mem_sem。
+**/
+
+#include "mb.h"
+
+//回写周期（毫秒）
+#ifndef MB_WB_FLUSH_INTERVAL
+#define  MB_WB_FLUSH_INTERVAL  1000
+#endif
+
+//脏区间表的最大项数，表满时将新区间合并到距离最近的已有区间中
+#ifndef MB_WB_RANGE_MAX
+#define  MB_WB_RANGE_MAX       8
+#endif
+
+//脏寄存器数量超过该值时提前唤醒回写任务
+#ifndef MB_WB_DIRTY_HIGH
+#define  MB_WB_DIRTY_HIGH      128
+#endif
+
+//单次写后备存储器的最大寄存器数量，决定回写任务中转缓冲区的大小
+#ifndef MB_WB_BATCH_MAX
+#define  MB_WB_BATCH_MAX       64
+#endif
+
+//回写任务优先级及堆栈大小
+#ifndef MB_WB_THREAD_PRIO
+#define  MB_WB_THREAD_PRIO     (TCPIP_THREAD_PRIO+2)
+#endif
+#ifndef MB_WB_THREAD_STKSIZE
+#define  MB_WB_THREAD_STKSIZE  DEFAULT_THREAD_STACKSIZE
+#endif
+
+//回写统计信息
+typedef struct mb_wb_stats
+{
+	unsigned int   marks;        //标记脏区间次数
+	unsigned int   merges;       //脏区间表满时的强制合并次数
+	unsigned int   writes;       //写后备存储器次数
+	unsigned int   errors;       //写后备存储器失败次数
+	unsigned short dirty;        //当前脏寄存器数量（合并后区间长度之和）
+	unsigned short dirty_max;    //脏寄存器数量高水位
+}mb_wb_stats_t;
+
+/**
+*后备存储器写函数，由移植层实现
+*usAddress:起始寄存器地址；pusRegs:寄存器值（主机字节序）；usNRegs:寄存器数量
+*返回值：写入成功返回MB_ENOERR，失败时该区间保留为脏区间，下个周期重试
+*/
+extern eMBErrorCode eMBRegHoldingStore(USHORT usAddress, const USHORT *pusRegs, USHORT usNRegs);
+
+void ModbusWriteBackInit(void);
+void ModbusWriteBackMark(USHORT usIndex, USHORT usNRegs);
+void ModbusWriteBackSync(void);
+void ModbusWriteBackStop(void);
+void ModbusWriteBackStats(mb_wb_stats_t *stats);
+
+#endif /* __MB_WRITEBACK_H__ */
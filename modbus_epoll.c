@@ -0,0 +1,632 @@
+/*
+*Linux epoll多线程Modbus/TCP从站服务器的实现。
+*
+*每个工作线程：
+*1.创建自己的侦听套接字（SO_REUSEPORT，绑定同一端口）和epoll实例，新连接由内核分配给某个工作线程；
+*2.连接表为静态数组加空闲链表，与mb_pool相同，运行时不分配内存；连接表已满时淘汰最久未活动的连接；
+*3.每个连接有独立的接收重组缓冲区和发送缓冲区。收到的数据按MBAP长度字段切分成完整的请求帧，
+*  请求帧被拷贝到发送缓冲区末尾，由ModbusFrameProcess就地生成响应，响应即留在发送缓冲区中等待发送，
+*  同一连接上流水线发送的多个请求依次处理；
+*4.发送缓冲区放不下下一个响应时暂停读取该连接，等待EPOLLOUT，直至发送缓冲区清空；
+*5.统计计数只由本线程写，读取时由ModbusEpollStats累加各线程的计数；
+*6.epoll事件数据中保存连接下标和连接的代数，连接关闭时代数加1。同一批事件中被淘汰的连接结构可能
+*  立即被新连接重用，属于旧连接的剩余事件因代数不符而被丢弃，不会作用到新连接上；
+*7.功能码处理函数访问的寄存器库、写回脏区表由所有工作线程共享，lwIP的SYS_ARCH_PROTECT在本后端
+*  中不起作用，因此ModbusFrameProcess的调用由epoll_data_lock互斥（MB_EPOLL_DATA_LOCK），
+*  帧的接收、切分和响应发送仍在各工作线程中并行进行。
+*
+*8.MB_EPOLL_WRITEBACK为1时由服务器启动回写任务，停止服务器时先等待工作线程退出，不再有新的寄存器
+*  写入，再写完剩余的脏寄存器并停止回写任务。
+*
+*编译时与FreeModbus的功能码处理函数（mbfunc*.c，xFuncHandlers需为非static）、mb_proc.c以及
+*应用程序的寄存器回调函数一起链接，需要-pthread。使用寄存器库和回写时的链接要求见modbus_epoll.h。
+*/
+
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <stdint.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include "mb_proc.h"
+#include "modbus_epoll.h"
+#if MB_EPOLL_WRITEBACK
+#include "mb_writeback.h"
+#endif
+
+//连接接收缓冲区可容纳两个最大帧，发送缓冲区可容纳四个最大响应
+#define  MB_EPOLL_RXBUF_SIZE     (2 * MB_MAX_BUF_SIZE)
+#define  MB_EPOLL_TXBUF_SIZE     (4 * MB_MAX_BUF_SIZE)
+
+//epoll_wait每次最多返回的事件数，及等待超时（毫秒），超时后检查空闲连接和停止标志
+#define  MB_EPOLL_EVENTS         64
+#define  MB_EPOLL_TICK           1000
+
+//TCP保活参数（秒），与lwIP服务器相同
+#define  MB_EPOLL_KEEPALIVE_IDLE   10
+#define  MB_EPOLL_KEEPALIVE_INTVL  2
+#define  MB_EPOLL_KEEPALIVE_CNT    3
+
+//工作线程结构按缓存行对齐分配，避免不同线程的统计计数落在同一缓存行
+#define  MB_EPOLL_CACHE_LINE     64
+
+//客户端连接
+typedef struct mb_epoll_conn
+{
+	int fd;                                       //套接字，-1表示空闲
+	unsigned int gen;                             //连接的代数，每次关闭时加1
+	unsigned int events;                          //当前在epoll中关注的事件
+	unsigned short rxlen;                         //接收缓冲区中的数据长度
+	unsigned short txoff, txlen;                  //发送缓冲区中已发送、待发送的位置
+	long last_active;                             //最近一次收到数据的时间（毫秒）
+	struct mb_epoll_conn *next;                   //空闲链表
+	unsigned char rxbuf[MB_EPOLL_RXBUF_SIZE];
+	unsigned char txbuf[MB_EPOLL_TXBUF_SIZE];
+}mb_epoll_conn_t;
+
+//工作线程
+typedef struct
+{
+	mb_epoll_stats_t stats;                       //本线程的统计计数，只由本线程写
+	pthread_t thread;
+	unsigned int index;
+	int epfd;                                     //epoll实例
+	int lfd;                                      //侦听套接字
+	mb_epoll_conn_t *free_list;                   //空闲连接链表
+	mb_epoll_conn_t conn[MB_EPOLL_CONN_NUM];
+}mb_epoll_worker_t;
+
+static mb_epoll_worker_t *epoll_workers[MB_EPOLL_WORKER_MAX];
+static unsigned int epoll_worker_num;
+static volatile int epoll_stop;
+#if MB_EPOLL_WRITEBACK
+static int epoll_wb_running;
+#endif
+
+#if MB_EPOLL_DATA_LOCK
+//工作线程共享的应用数据互斥锁，见文件头说明
+static pthread_mutex_t epoll_data_lock = PTHREAD_MUTEX_INITIALIZER;
+#endif
+
+//侦听套接字的事件数据，连接的事件数据为(代数 << 32) | (连接下标 + 1)，不会为0
+#define  MB_EPOLL_KEY_LISTEN     0
+
+//当前时间（毫秒）
+static long ModbusEpollNow(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+//连接在epoll中的事件数据
+static uint64_t ModbusEpollKey(const mb_epoll_worker_t *w, const mb_epoll_conn_t *c)
+{
+	return ((uint64_t)c->gen << 32) | (uint64_t)(c - w->conn + 1);
+}
+
+//由事件数据找到连接，连接已关闭或已被新连接重用时返回NULL
+static mb_epoll_conn_t *ModbusEpollConn(mb_epoll_worker_t *w, uint64_t key)
+{
+	mb_epoll_conn_t *c = &w->conn[(uint32_t)key - 1];
+
+	if (c->fd < 0 || c->gen != (unsigned int)(key >> 32))
+	{
+		return NULL;
+	}
+	return c;
+}
+
+//修改连接在epoll中关注的事件
+static void ModbusEpollWatch(mb_epoll_worker_t *w, mb_epoll_conn_t *c, unsigned int events)
+{
+	struct epoll_event ev;
+
+	if (c->events == events)
+	{
+		return;
+	}
+
+	ev.events = events;
+	ev.data.u64 = ModbusEpollKey(w, c);
+	epoll_ctl(w->epfd, EPOLL_CTL_MOD, c->fd, &ev);
+	c->events = events;
+}
+
+//关闭连接，将连接结构放回空闲链表
+static void ModbusEpollClose(mb_epoll_worker_t *w, mb_epoll_conn_t *c)
+{
+	close(c->fd);              //关闭套接字时自动从epoll中删除
+	c->fd = -1;
+	c->gen++;                  //同一批事件中属于该连接的剩余事件作废
+	c->next = w->free_list;
+	w->free_list = c;
+}
+
+//连接表已满时，淘汰最久未活动的连接
+static mb_epoll_conn_t *ModbusEpollEvict(mb_epoll_worker_t *w)
+{
+	mb_epoll_conn_t *victim = &w->conn[0];
+	unsigned int i;
+
+	for (i = 1; i < MB_EPOLL_CONN_NUM; i++)
+	{
+		if (w->conn[i].last_active < victim->last_active)
+		{
+			victim = &w->conn[i];
+		}
+	}
+
+	ModbusEpollClose(w, victim);
+	w->stats.evicted++;
+
+	w->free_list = victim->next;
+	return victim;
+}
+
+//接受侦听套接字上的所有新连接
+static void ModbusEpollAccept(mb_epoll_worker_t *w)
+{
+	mb_epoll_conn_t *c;
+	struct epoll_event ev;
+	int fd, one = 1;
+	int idle = MB_EPOLL_KEEPALIVE_IDLE, intvl = MB_EPOLL_KEEPALIVE_INTVL, cnt = MB_EPOLL_KEEPALIVE_CNT;
+
+	while ((fd = accept4(w->lfd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC)) >= 0)
+	{
+		c = w->free_list;
+		if (c != NULL)
+		{
+			w->free_list = c->next;
+		}
+		else
+		{
+			c = ModbusEpollEvict(w);
+		}
+
+		setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+		setsockopt(fd, SOL_SOCKET, SO_KEEPALIVE, &one, sizeof(one));
+		setsockopt(fd, IPPROTO_TCP, TCP_KEEPIDLE, &idle, sizeof(idle));
+		setsockopt(fd, IPPROTO_TCP, TCP_KEEPINTVL, &intvl, sizeof(intvl));
+		setsockopt(fd, IPPROTO_TCP, TCP_KEEPCNT, &cnt, sizeof(cnt));
+
+		c->fd = fd;
+		c->events = EPOLLIN;
+		c->rxlen = 0;
+		c->txoff = 0;
+		c->txlen = 0;
+		c->last_active = ModbusEpollNow();
+
+		ev.events = EPOLLIN;
+		ev.data.u64 = ModbusEpollKey(w, c);
+		if (epoll_ctl(w->epfd, EPOLL_CTL_ADD, fd, &ev) != 0)
+		{
+			ModbusEpollClose(w, c);
+			continue;
+		}
+		w->stats.accepted++;
+	}
+}
+
+/**
+*处理接收缓冲区中的完整请求帧，响应追加到发送缓冲区
+*返回值：处理的请求帧个数；MBAP帧头不合法时返回-1，此时无法在字节流中重新定位帧边界，应关闭连接
+*/
+static int ModbusEpollProcess(mb_epoll_worker_t *w, mb_epoll_conn_t *c)
+{
+	unsigned int usPID, usLength, flen;
+	unsigned char *frame;
+	USHORT rsplen;
+	eMBServerErrorCode processflag;
+	int num = 0;
+
+	while (c->rxlen >= LWIP_TCP_UID)
+	{
+		usPID = (c->rxbuf[LWIP_TCP_PID] << 8U) + c->rxbuf[LWIP_TCP_PID+1];
+		usLength = (c->rxbuf[LWIP_TCP_LEN] << 8U) + c->rxbuf[LWIP_TCP_LEN+1];
+		flen = usLength + LWIP_TCP_UID;
+
+		if (usPID != MODBUSTCP_PROTOCOL_ID || flen < LWIP_TCP_FUNC + 1 || flen > MB_MAX_BUF_SIZE)
+		{
+			w->stats.request++;
+			w->stats.err[MBS_BADPROCTOL]++;
+			return -1;
+		}
+
+		//请求帧不完整，或发送缓冲区放不下一个最大响应
+		if (c->rxlen < flen || c->txlen + MB_MAX_BUF_SIZE > MB_EPOLL_TXBUF_SIZE)
+		{
+			break;
+		}
+
+		//请求帧拷贝到发送缓冲区末尾，就地生成响应
+		frame = &c->txbuf[c->txlen];
+		memcpy(frame, c->rxbuf, flen);
+		c->rxlen -= flen;
+		memmove(c->rxbuf, c->rxbuf + flen, c->rxlen);
+		num++;
+
+		w->stats.request++;
+#if MB_EPOLL_DATA_LOCK
+		pthread_mutex_lock(&epoll_data_lock);
+#endif
+		processflag = ModbusFrameProcess(frame, (USHORT)flen, &rsplen);
+#if MB_EPOLL_DATA_LOCK
+		pthread_mutex_unlock(&epoll_data_lock);
+#endif
+		if (processflag != MBS_ERROK)
+		{
+			w->stats.err[processflag]++;
+			continue;
+		}
+
+		if (rsplen == 0)           //广播请求，不返回任何结果
+		{
+			w->stats.noresponse++;
+			continue;
+		}
+
+		if (frame[LWIP_TCP_FUNC] & 0x80)
+		{
+			w->stats.exception++;
+		}
+		w->stats.response++;
+		c->txlen += rsplen;
+	}
+
+	return num;
+}
+
+//判断接收缓冲区中是否有完整的请求帧
+static int ModbusEpollFrameReady(const mb_epoll_conn_t *c)
+{
+	unsigned int usLength;
+
+	if (c->rxlen < LWIP_TCP_UID)
+	{
+		return 0;
+	}
+
+	usLength = (c->rxbuf[LWIP_TCP_LEN] << 8U) + c->rxbuf[LWIP_TCP_LEN+1];
+	return c->rxlen >= usLength + LWIP_TCP_UID;
+}
+
+//发送发送缓冲区中的响应，返回-1表示连接出错
+static int ModbusEpollFlush(mb_epoll_worker_t *w, mb_epoll_conn_t *c)
+{
+	ssize_t n;
+
+	while (c->txoff < c->txlen)
+	{
+		n = send(c->fd, &c->txbuf[c->txoff], c->txlen - c->txoff, MSG_NOSIGNAL);
+		if (n > 0)
+		{
+			c->txoff += (unsigned short)n;
+			w->stats.tx_bytes += (unsigned long)n;
+		}
+		else if (errno == EAGAIN || errno == EWOULDBLOCK)
+		{
+			break;
+		}
+		else if (errno != EINTR)
+		{
+			w->stats.err[MBS_ERRSEND]++;
+			return -1;
+		}
+	}
+
+	if (c->txoff == c->txlen)
+	{
+		c->txoff = 0;
+		c->txlen = 0;
+	}
+
+	return 0;
+}
+
+//处理连接上的读写事件，返回-1表示应关闭连接
+static int ModbusEpollService(mb_epoll_worker_t *w, mb_epoll_conn_t *c, unsigned int events)
+{
+	ssize_t n;
+	int num;
+
+	if (events & (EPOLLERR | EPOLLHUP))
+	{
+		return -1;
+	}
+
+	if ((events & EPOLLIN) && c->rxlen < MB_EPOLL_RXBUF_SIZE)
+	{
+		n = recv(c->fd, &c->rxbuf[c->rxlen], MB_EPOLL_RXBUF_SIZE - c->rxlen, 0);
+		if (n == 0 || (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR))
+		{
+			return -1;           //客户端关闭连接或连接出错
+		}
+		if (n > 0)
+		{
+			c->rxlen += (unsigned short)n;
+			c->last_active = ModbusEpollNow();
+			w->stats.rx_bytes += (unsigned long)n;
+		}
+	}
+
+	//处理请求并发送响应，发送缓冲区清空后继续处理剩余的请求帧。
+	//EPOLLOUT时发送缓冲区在处理之后才被清空，此时本轮处理的请求数可能为0，
+	//因此以接收缓冲区中是否还有完整请求帧作为循环条件
+	do
+	{
+		num = ModbusEpollProcess(w, c);
+		if (num < 0 || ModbusEpollFlush(w, c) != 0)
+		{
+			return -1;
+		}
+	}while (c->txlen == 0 && ModbusEpollFrameReady(c));
+
+	//响应未发送完，或仍有未处理的完整请求帧时暂停读取，等待套接字可写；
+	//否则等待新的请求数据
+	ModbusEpollWatch(w, c, (c->txlen || ModbusEpollFrameReady(c)) ? EPOLLOUT : EPOLLIN);
+
+	return 0;
+}
+
+//关闭空闲超时的连接
+static void ModbusEpollReap(mb_epoll_worker_t *w, long now)
+{
+	unsigned int i;
+
+	for (i = 0; i < MB_EPOLL_CONN_NUM; i++)
+	{
+		if (w->conn[i].fd >= 0 && now - w->conn[i].last_active > MB_EPOLL_IDLE_TIMEOUT)
+		{
+			ModbusEpollClose(w, &w->conn[i]);
+			w->stats.idle_closed++;
+		}
+	}
+}
+
+//工作线程
+static void *ModbusEpollThread(void *arg)
+{
+	mb_epoll_worker_t *w = (mb_epoll_worker_t *)arg;
+	struct epoll_event events[MB_EPOLL_EVENTS];
+	mb_epoll_conn_t *c;
+	long now, reap_last = ModbusEpollNow();
+	int i, n;
+
+	while (!epoll_stop)
+	{
+		n = epoll_wait(w->epfd, events, MB_EPOLL_EVENTS, MB_EPOLL_TICK);
+
+		for (i = 0; i < n; i++)
+		{
+			if (events[i].data.u64 == MB_EPOLL_KEY_LISTEN)       //侦听套接字
+			{
+				ModbusEpollAccept(w);
+				continue;
+			}
+
+			c = ModbusEpollConn(w, events[i].data.u64);
+			if (c != NULL && ModbusEpollService(w, c, events[i].events) != 0)
+			{
+				ModbusEpollClose(w, c);
+			}
+		}
+
+		now = ModbusEpollNow();
+		if (now - reap_last >= MB_EPOLL_TICK)
+		{
+			ModbusEpollReap(w, now);
+			reap_last = now;
+		}
+	}
+
+	return NULL;
+}
+
+//创建侦听套接字，各工作线程以SO_REUSEPORT方式绑定同一端口
+static int ModbusEpollListen(unsigned short port)
+{
+	struct sockaddr_in addr;
+	int fd, one = 1;
+
+	fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	if (fd < 0)
+	{
+		return -1;
+	}
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_ANY);
+	addr.sin_port = htons(port);
+
+	if (setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one)) != 0
+		|| setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &one, sizeof(one)) != 0
+		|| bind(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0
+		|| listen(fd, SOMAXCONN) != 0)
+	{
+		close(fd);
+		return -1;
+	}
+
+	return fd;
+}
+
+//创建一个工作线程，工作线程数不超过CPU数时将其绑定到对应的CPU上
+static mb_epoll_worker_t *ModbusEpollWorkerNew(unsigned int index, unsigned short port, unsigned int ncpu)
+{
+	mb_epoll_worker_t *w;
+	struct epoll_event ev;
+	cpu_set_t cpus;
+	unsigned int i;
+
+	if (posix_memalign((void **)&w, MB_EPOLL_CACHE_LINE, sizeof(mb_epoll_worker_t)) != 0)
+	{
+		return NULL;
+	}
+
+	memset(&w->stats, 0, sizeof(w->stats));
+	w->index = index;
+	w->free_list = NULL;
+	for (i = MB_EPOLL_CONN_NUM; i > 0; i--)
+	{
+		w->conn[i - 1].fd = -1;
+		w->conn[i - 1].gen = 0;
+		w->conn[i - 1].next = w->free_list;
+		w->free_list = &w->conn[i - 1];
+	}
+
+	w->lfd = ModbusEpollListen(port);
+	w->epfd = epoll_create1(EPOLL_CLOEXEC);
+	ev.events = EPOLLIN;
+	ev.data.u64 = MB_EPOLL_KEY_LISTEN;
+	if (w->lfd < 0 || w->epfd < 0 || epoll_ctl(w->epfd, EPOLL_CTL_ADD, w->lfd, &ev) != 0
+		|| pthread_create(&w->thread, NULL, ModbusEpollThread, w) != 0)
+	{
+		if (w->lfd >= 0) close(w->lfd);
+		if (w->epfd >= 0) close(w->epfd);
+		free(w);
+		return NULL;
+	}
+
+	if (index < ncpu)
+	{
+		CPU_ZERO(&cpus);
+		CPU_SET(index, &cpus);
+		pthread_setaffinity_np(w->thread, sizeof(cpus), &cpus);
+	}
+
+	return w;
+}
+
+/**
+*启动服务器
+*port:侦听端口，0表示MB_EPOLL_DEFAULT_PORT；workers:工作线程数，0表示在线CPU数
+*返回值：成功返回0，失败返回-1（已创建的工作线程被停止）
+*/
+int ModbusEpollServerStart(unsigned short port, unsigned int workers)
+{
+	long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+	unsigned int i;
+
+	if (ncpu < 1)
+	{
+		ncpu = 1;
+	}
+	if (port == 0)
+	{
+		port = MB_EPOLL_DEFAULT_PORT;
+	}
+	if (workers == 0)
+	{
+		workers = (unsigned int)ncpu;
+	}
+	if (workers > MB_EPOLL_WORKER_MAX)
+	{
+		workers = MB_EPOLL_WORKER_MAX;
+	}
+
+	epoll_stop = 0;
+#if MB_EPOLL_WRITEBACK
+	if (!epoll_wb_running)
+	{
+		ModbusWriteBackInit();
+		epoll_wb_running = 1;
+	}
+#endif
+	for (i = 0; i < workers; i++)
+	{
+		epoll_workers[i] = ModbusEpollWorkerNew(i, port, (unsigned int)ncpu);
+		if (epoll_workers[i] == NULL)
+		{
+			ModbusEpollServerStop();
+			return -1;
+		}
+		epoll_worker_num = i + 1;
+	}
+
+	return 0;
+}
+
+//停止服务器，等待各工作线程退出并关闭所有连接
+void ModbusEpollServerStop(void)
+{
+	mb_epoll_worker_t *w;
+	unsigned int i, j;
+
+	epoll_stop = 1;
+	for (i = 0; i < epoll_worker_num; i++)
+	{
+		w = epoll_workers[i];
+		pthread_join(w->thread, NULL);
+
+		for (j = 0; j < MB_EPOLL_CONN_NUM; j++)
+		{
+			if (w->conn[j].fd >= 0)
+			{
+				close(w->conn[j].fd);
+			}
+		}
+		close(w->lfd);
+		close(w->epfd);
+		free(w);
+		epoll_workers[i] = NULL;
+	}
+	epoll_worker_num = 0;
+
+#if MB_EPOLL_WRITEBACK
+	//工作线程均已退出，写完剩余的脏寄存器后停止回写任务
+	if (epoll_wb_running)
+	{
+		ModbusWriteBackStop();
+		epoll_wb_running = 0;
+	}
+#endif
+}
+
+//读取工作线程数
+unsigned int ModbusEpollWorkers(void)
+{
+	return epoll_worker_num;
+}
+
+/**
+*读取统计计数
+*worker:工作线程序号，小于0时返回所有工作线程的计数之和
+*返回值：成功返回0，工作线程不存在返回-1
+*/
+int ModbusEpollStats(int worker, mb_epoll_stats_t *stats)
+{
+	const unsigned long *src;
+	unsigned long *dst = (unsigned long *)stats;
+	unsigned int i, j, first, last;
+
+	if (worker >= (int)epoll_worker_num)
+	{
+		return -1;
+	}
+
+	first = (worker < 0) ? 0 : (unsigned int)worker;
+	last = (worker < 0) ? epoll_worker_num : (unsigned int)worker + 1;
+
+	//统计结构全部由unsigned long组成，逐项累加
+	memset(stats, 0, sizeof(*stats));
+	for (i = first; i < last; i++)
+	{
+		src = (const unsigned long *)&epoll_workers[i]->stats;
+		for (j = 0; j < sizeof(mb_epoll_stats_t) / sizeof(unsigned long); j++)
+		{
+			dst[j] += src[j];
+		}
+	}
+
+	return 0;
+}
@@ -0,0 +1,75 @@
+#ifndef __MODBUS_EPOLL_H__
+#define __MODBUS_EPOLL_H__
+
+/**
+*Linux下的Modbus/TCP从站服务器后端，用于在Linux小型主机而非uC/OS开发板上运行服务器。
+*服务器由多个工作线程组成，每个工作线程拥有独立的epoll循环和以SO_REUSEPORT方式绑定在同一端口上的
+*侦听套接字，由内核在各侦听套接字之间分配新连接。连接只由接受它的工作线程服务，请求解析和
+*功能码分派与lwIP服务器相同，都由ModbusFrameProcess完成。每个工作线程拥有自己的连接表、处理缓冲区
+*和统计计数，连接的接收、切分和发送在各工作线程中并行进行，不需要mem_sem。
+*
+*注意：功能码处理函数所访问的寄存器库（mb_regbank.c）、写回脏区表（mb_writeback.c）等应用数据
+*由所有工作线程共享，而这些模块依赖的SYS_ARCH_PROTECT在Linux下不起作用。默认由一个全局互斥锁
+*串行化各工作线程对ModbusFrameProcess的调用；若应用程序的功能码处理函数本身是线程安全的，
+*可将MB_EPOLL_DATA_LOCK定义为0，使请求处理也完全并行。
+*
+*使用寄存器库时，FC6/FC16写入的保持寄存器由回写任务写入后备存储器：MB_EPOLL_WRITEBACK为1时
+*ModbusEpollServerStart启动回写任务，ModbusEpollServerStop在工作线程退出后写完剩余的脏寄存器并停止
+*回写任务，此时需与mb_writeback.c、lwIP的unix移植层（sys_arch）及应用程序的eMBRegHoldingStore一起
+*链接。Linux下默认的计算型寄存器表为空（见mb_regbank.h），uC/OS的统计寄存器不可用。
+**/
+
+//Modbus TCP服务器熟知端口号
+#ifndef MB_EPOLL_DEFAULT_PORT
+#define  MB_EPOLL_DEFAULT_PORT     502
+#endif
+
+//最大工作线程数，启动时指定0则使用在线CPU数
+#ifndef MB_EPOLL_WORKER_MAX
+#define  MB_EPOLL_WORKER_MAX       64
+#endif
+
+//每个工作线程最多服务的连接数
+#ifndef MB_EPOLL_CONN_NUM
+#define  MB_EPOLL_CONN_NUM         256
+#endif
+
+//客户端连接空闲超时（毫秒），与lwIP服务器的MB_CLIENT_IDLE_TIMEOUT含义相同
+#ifndef MB_EPOLL_IDLE_TIMEOUT
+#define  MB_EPOLL_IDLE_TIMEOUT     60000
+#endif
+
+//串行化各工作线程的请求处理，保护共享的应用数据
+#ifndef MB_EPOLL_DATA_LOCK
+#define  MB_EPOLL_DATA_LOCK        1
+#endif
+
+//由服务器启动和停止写回任务，应用程序不使用寄存器库（mb_regbank.c）时可定义为0
+#ifndef MB_EPOLL_WRITEBACK
+#define  MB_EPOLL_WRITEBACK        1
+#endif
+
+//工作线程错误码对应的统计项个数，与eMBServerErrorCode一致
+#define  MB_EPOLL_ERR_NUM          5
+
+//服务器运行统计，各工作线程分别计数，读取时累加
+typedef struct
+{
+	unsigned long accepted;              //接受的连接数
+	unsigned long evicted;               //连接表已满时被淘汰的连接数
+	unsigned long idle_closed;           //因空闲超时被关闭的连接数
+	unsigned long request;               //收到的请求数
+	unsigned long response;              //返回的响应数（含异常响应）
+	unsigned long exception;             //异常响应数
+	unsigned long noresponse;            //无需响应的请求数（广播）
+	unsigned long rx_bytes;              //接收字节数
+	unsigned long tx_bytes;              //发送字节数
+	unsigned long err[MB_EPOLL_ERR_NUM]; //各错误码出现的次数，下标为eMBServerErrorCode
+}mb_epoll_stats_t;
+
+int  ModbusEpollServerStart(unsigned short port, unsigned int workers);
+void ModbusEpollServerStop(void);
+unsigned int ModbusEpollWorkers(void);
+int  ModbusEpollStats(int worker, mb_epoll_stats_t *stats);
+
+#endif /* __MODBUS_EPOLL_H__ */
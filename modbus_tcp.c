@@ -1,34 +1,85 @@
-#define  MAX_CLIENT_NUM    5     //最大子任务数（最大并发数量）
-#define  CLIENT_STK_SIZE   256   //各子任务堆栈大小
-
-#define  CLIENT_START_PRIO 15    //各子任务其实优先级
+#include "lwip/tcpip.h"
+#include "mb_pool.h"
+#include "mb_writeback.h"
+#include "tcp_rtu.h"
+#include "mb_stats.h"
+#include "mb_capture.h"
+#include "mb_proc.h"
+#include "mb_discovery.h"
+#include "modbus_tcp.h"
+
+//子任务角色：从站服务器（配合modbus_p.c）或网关服务器（配合tcp_rtu.c），
+//两者调用链深度不同，堆栈可按角色分别配置
+#define  MB_ROLE_SLAVE     0
+#define  MB_ROLE_GATEWAY   1
+
+#ifndef MODBUS_SERVER_ROLE
+#define  MODBUS_SERVER_ROLE  MB_ROLE_SLAVE
+#endif
+
+//各角色子任务堆栈大小（字），应以ModbusStackUsage实测的高水位加适当余量来确定，
+//运行时可从UDP统计报文中读取各堆栈区的高水位（见mb_stats.c）
+#ifndef CLIENT_STK_SIZE_SLAVE
+#define  CLIENT_STK_SIZE_SLAVE    256
+#endif
+
+#ifndef CLIENT_STK_SIZE_GATEWAY
+#define  CLIENT_STK_SIZE_GATEWAY  256
+#endif
+
+#if MODBUS_SERVER_ROLE == MB_ROLE_GATEWAY
+#define  CLIENT_STK_SIZE   CLIENT_STK_SIZE_GATEWAY     //各子任务堆栈大小
+#else
+#define  CLIENT_STK_SIZE   CLIENT_STK_SIZE_SLAVE
+#endif
+
+//服务器主任务优先级及堆栈大小
+#define  MODBUS_SERVER_PRIO      (CLIENT_START_PRIO - 1)
+#ifndef MODBUS_SERVER_STK_SIZE
+#define  MODBUS_SERVER_STK_SIZE  256
+#endif
 
 //根据操作系统的特性，需要为每个任务自行分配堆栈空间
 typedef struct child_stack
 {
 	OS_STK stk_area[MAX_CLIENT_NUM][CLIENT_STK_SIZE];    //所有子任务堆栈
+	unsigned short stk_used_max[MAX_CLIENT_NUM];         //各堆栈区历次使用量的高水位（字）
 	unsigned int stack_bitmap;                           //用位图表示堆栈分配情况
 	sys_sem_t stack_sem;                                 //堆栈区访问互斥量
 }child_stack_t;
 
 child_stack_t child_stack_areas;                         //定义堆栈管理空间
 
+static OS_STK server_stk_area[MODBUS_SERVER_STK_SIZE];  //服务器主任务堆栈
+
 //各个子任务访问共享资源的互斥信号量，这使用静态全局变量
 static sys_sem_t mem_sem;
 
+//客户端连接空闲超时（毫秒），超过该时间未收到请求则关闭连接，释放子任务堆栈
+#ifndef MB_CLIENT_IDLE_TIMEOUT
+#define  MB_CLIENT_IDLE_TIMEOUT   60000
+#endif
+
+//子任务接收超时（毫秒），子任务每隔该时间检查一次空闲超时和淘汰标志
+#define  MB_CLIENT_RECV_POLL      500
+
+//连接已满时，等待被淘汰连接释放子任务堆栈的最长时间（毫秒）
+#define  MB_EVICT_WAIT            2000
+#define  MB_EVICT_POLL            50
+
+//TCP保活参数（毫秒），用于及时发现已重启主机遗留的半开连接
+#define  MB_KEEPALIVE_IDLE        10000    //空闲多久后开始发送保活探测
+#define  MB_KEEPALIVE_INTVL       2000     //保活探测间隔
+#define  MB_KEEPALIVE_CNT         3        //保活探测次数
+
+#define  MB_MS_TO_TICKS(ms)       ((INT32U)(ms) * OS_TICKS_PER_SEC / 1000)
+
+//各堆栈区上正在服务的连接，用于选择被淘汰的连接，由stack_sem保护
+static mb_conn_t *conn_table[MAX_CLIENT_NUM];
+
 //Modbus TCP服务器熟知端口号
 #define  MODBUS_SERVER_DEFAULT_PORT  502
 
-//服务器内部处理错误码
-typedef enum
-{
-	MBS_ERROK,       //无错误
-	MBS_BADREQUEST,  //请求不完整
-	MBS_BADPROCTOL,  //协议验证失败
-	MBS_ERRFUNC,     //功能码错误
-	MBS_ERRSEND,     //返回数据失败
-}eMBServerErrorCode;
-
 //管理子任务堆栈的几个函数，用位图来标识某个堆栈区域是否被使用
 //堆栈任务分配时，查找为0的最低bit位并将其对应的堆栈区域分配给任务使用
 //堆栈回收时，在位图中清除堆栈区域对应的bit位
@@ -36,7 +87,14 @@ typedef enum
 //堆栈管理空间初始化
 err_t ModbusStackInit(void)
 {
+	unsigned int i;
+
 	child_stack_areas.stack_bitmap = 0;                     //初始化时，堆栈管理空间结构体内的位图清零
+	for (i = 0; i < MAX_CLIENT_NUM; i++)
+	{
+		child_stack_areas.stk_used_max[i] = 0;
+		conn_table[i] = NULL;
+	}
 	return sys_sem_new(&child_stack_areas.stack_sem, 1);    //初始化互斥信号量，为1
 }
 
@@ -58,12 +116,205 @@ unsigned int ModbusStackFind(void)
 	return i;
 }
 
-//堆栈分配，在为位图中将堆栈区域对应的bit位置1
-void ModubsStackGet(unsigned int index)
+//堆栈分配，在为位图中将堆栈区域对应的bit位置1，并记录该堆栈区上服务的连接
+void ModubsStackGet(unsigned int index, mb_conn_t *ctx)
 {
 	sys_sem_wait(&child_stack_areas.stack_sem);
 	child_stack_areas.stack_bitmap |= (0x01 << index);
+	conn_table[index] = ctx;
+	sys_sem_signal(&child_stack_areas.stack_sem);
+}
+
+//堆栈回收，记录子任务的堆栈使用量高水位，释放连接上下文后，在位图中将堆栈区域对应的bit位清0
+//连接表项先于连接上下文清除，且两者都在stack_sem内完成，淘汰时不会访问到已释放的连接上下文；
+//连接上下文先于堆栈区释放，主任务为新连接分配到堆栈区时一定也能分配到连接上下文
+//注意：须在子任务自身中调用（OSTaskDel之前），以便检查当前任务的堆栈
+void ModbusStackFree(unsigned int index, mb_conn_t *ctx)
+{
+	OS_STK_DATA stk_data;
+
+	sys_sem_wait(&child_stack_areas.stack_sem);
+	if (OSTaskStkChk(OS_PRIO_SELF, &stk_data) == OS_ERR_NONE)
+	{
+		unsigned short used = stk_data.OSUsed / sizeof(OS_STK);
+		if (used > child_stack_areas.stk_used_max[index])
+			child_stack_areas.stk_used_max[index] = used;
+	}
+	conn_table[index] = NULL;
+	ModbusPoolFree(MBPOOL_CONN, ctx);
+	child_stack_areas.stack_bitmap &= ~(0x01 << index);
+	sys_sem_signal(&child_stack_areas.stack_sem);
+}
+
+/**
+*连接已满时淘汰最久未活动的连接，并等待其子任务退出
+*被淘汰连接的子任务在处理完当前请求或下一次接收超时（最多MB_CLIENT_RECV_POLL）时关闭连接并释放堆栈区
+*返回值：释放出的堆栈区索引，在MB_EVICT_WAIT内未能释放则返回MAX_CLIENT_NUM
+*/
+unsigned int ModbusConnEvict(void)
+{
+	unsigned int i, victim = MAX_CLIENT_NUM;
+	mb_conn_t *victim_ctx = NULL;
+	INT32U now = OSTimeGet(), idle, idle_max = 0;
+	unsigned int waited = 0;
+
+	sys_sem_wait(&child_stack_areas.stack_sem);
+	for (i = 0; i < MAX_CLIENT_NUM; i++)
+	{
+		if (conn_table[i] == NULL)
+			continue;
+
+		//已有连接正在被淘汰，等待其退出即可
+		if (conn_table[i]->evict)
+		{
+			victim = MAX_CLIENT_NUM;
+			break;
+		}
+
+		idle = now - conn_table[i]->last_active;
+		if (victim == MAX_CLIENT_NUM || idle > idle_max)
+		{
+			idle_max = idle;
+			victim = i;
+		}
+	}
+	if (victim < MAX_CLIENT_NUM)
+	{
+		victim_ctx = conn_table[victim];
+		victim_ctx->evict = 1;
+	}
+	sys_sem_signal(&child_stack_areas.stack_sem);
+
+	//等待被淘汰的子任务退出
+	while ((i = ModbusStackFind()) >= MAX_CLIENT_NUM && waited < MB_EVICT_WAIT)
+	{
+		OSTimeDlyHMSM(0, 0, 0, MB_EVICT_POLL);
+		waited += MB_EVICT_POLL;
+	}
+
+	if (i < MAX_CLIENT_NUM)
+	{
+		//只有确实腾出了堆栈区才计入被淘汰的连接数（也可能是其他连接恰好自行退出）
+		if (victim_ctx != NULL)
+			ModbusStatsInc(MB_STAT_EVICTED);
+
+		//子任务释放堆栈区后紧接着删除自身，稍作延时保证其优先级已被释放
+		OSTimeDly(1);
+	}
+	else if (victim_ctx != NULL)
+	{
+		//等待超时，撤销淘汰标志，否则之后的淘汰都会因该标志而放弃
+		sys_sem_wait(&child_stack_areas.stack_sem);
+		if (conn_table[victim] == victim_ctx)
+			victim_ctx->evict = 0;
+		sys_sem_signal(&child_stack_areas.stack_sem);
+	}
+
+	return i;
+}
+
+#if LWIP_TCP_KEEPALIVE
+//设置保活参数，tcp_pcb只能在内核锁内或tcpip内核线程中访问
+static void ModbusConnKeepAliveSet(void *arg)
+{
+	struct netconn *conn = (struct netconn *)arg;
+
+	//连接可能已被对端复位，此时pcb已被释放
+	if (conn->pcb.tcp == NULL)
+	{
+		return;
+	}
+
+	conn->pcb.tcp->so_options |= SOF_KEEPALIVE;
+	conn->pcb.tcp->keep_idle  = MB_KEEPALIVE_IDLE;
+	conn->pcb.tcp->keep_intvl = MB_KEEPALIVE_INTVL;
+	conn->pcb.tcp->keep_cnt   = MB_KEEPALIVE_CNT;
+}
+#endif
+
+//为新连接打开TCP保活功能（需使能LWIP_TCP_KEEPALIVE）
+//使能LWIP_TCPIP_CORE_LOCKING时netconn_delete在调用者中直接释放netconn，投递的回调可能在连接删除之后
+//才执行，因此直接在内核锁内设置；否则netconn_delete与tcpip_callback经由同一邮箱投递给内核线程，
+//回调一定在连接删除之前执行
+static void ModbusConnKeepAlive(struct netconn *conn)
+{
+#if LWIP_TCP_KEEPALIVE
+#if LWIP_TCPIP_CORE_LOCKING
+	LOCK_TCPIP_CORE();
+	ModbusConnKeepAliveSet(conn);
+	UNLOCK_TCPIP_CORE();
+#else
+	tcpip_callback(ModbusConnKeepAliveSet, conn);
+#endif
+#endif
+}
+
+/**
+*查询任务堆栈使用情况。任务以OS_TASK_OPT_STK_CLR方式创建，创建时堆栈被清零（堆栈着色），
+*OSTaskStkChk从栈底开始统计仍为0的单元，从而得到堆栈实际使用量。
+*index:子任务堆栈区索引，为MAX_CLIENT_NUM时表示服务器主任务
+*usage:返回堆栈大小、当前使用量及高水位
+*返回值：index不合法时返回OS_ERR_PRIO_INVALID，否则返回OS_ERR_NONE
+*/
+unsigned char ModbusStackUsage(unsigned int index, mb_stack_usage_t *usage)
+{
+	OS_STK_DATA stk_data;
+
+	if (index > MAX_CLIENT_NUM)
+	{
+		return OS_ERR_PRIO_INVALID;
+	}
+
+	//服务器主任务始终存在，其高水位即当前检测结果
+	if (index == MAX_CLIENT_NUM)
+	{
+		usage->size = MODBUS_SERVER_STK_SIZE;
+		usage->used = 0;
+		if (OSTaskStkChk(MODBUS_SERVER_PRIO, &stk_data) == OS_ERR_NONE)
+			usage->used = stk_data.OSUsed / sizeof(OS_STK);
+		usage->used_max = usage->used;
+		return OS_ERR_NONE;
+	}
+
+	sys_sem_wait(&child_stack_areas.stack_sem);
+
+	usage->size = CLIENT_STK_SIZE;
+	usage->used = 0;
+	if ((child_stack_areas.stack_bitmap >> index) & 0x01)
+	{
+		//堆栈区正在使用，检测对应子任务的堆栈
+		if (OSTaskStkChk(CLIENT_START_PRIO + index, &stk_data) == OS_ERR_NONE)
+		{
+			usage->used = stk_data.OSUsed / sizeof(OS_STK);
+			if (usage->used > child_stack_areas.stk_used_max[index])
+				child_stack_areas.stk_used_max[index] = usage->used;
+		}
+	}
+	usage->used_max = child_stack_areas.stk_used_max[index];
+
 	sys_sem_signal(&child_stack_areas.stack_sem);
+
+	return OS_ERR_NONE;
+}
+
+//查询空闲的子任务堆栈区（即还可接受的连接）数量，total返回最大连接数，供网关发现通告使用
+unsigned int ModbusConnFree(unsigned int *total)
+{
+	unsigned int i, num = 0;
+
+	sys_sem_wait(&child_stack_areas.stack_sem);
+	for (i = 0; i < MAX_CLIENT_NUM; i++)
+	{
+		if (!((child_stack_areas.stack_bitmap >> i) & 0x01))
+			num++;
+	}
+	sys_sem_signal(&child_stack_areas.stack_sem);
+
+	if (total != NULL)
+	{
+		*total = MAX_CLIENT_NUM;
+	}
+	return num;
 }
 
 //服务器主任务
@@ -75,6 +326,16 @@ void ModbusMainServer(void *p_arg)
 
 	ret = sys_sem_new($mem_sem, 1);    //初始化访问共享资源的互斥信号量
 	ret = ModbusStackInit();           //初始化子任务堆栈管理
+	ModbusPoolInit();                  //初始化连接上下文、帧及事务对象内存池
+	ModbusStatsInit();                 //启动统计任务，提供UDP统计端口
+	ModbusCaptureInit();               //启动捕获任务，提供TCP捕获导出端口
+#if MODBUS_SERVER_ROLE == MB_ROLE_SLAVE
+	ModbusWriteBackInit();             //启动保持寄存器回写任务
+	eMBRegisterCB(MB_FUNC_DIAG_DIAGNOSTIC, eMBFuncDiagnostics);    //注册FC8诊断功能码
+#else
+	ModbusGateInit();                  //初始化串口互斥量及下游Modbus/TCP连接
+	ModbusDiscoveryInit();             //启动网关发现通告任务
+#endif
 
 	conn = netconn_new(NETCONN_TCP);   //初始化TCP服务器
 	ret = netconn_bind(conn, NULL, MODBUS_SERVER_DEFAULT_PORT);
@@ -85,25 +346,47 @@ void ModbusMainServer(void *p_arg)
 		ret = netconn_accept(conn, &newconn);    //服务器阻塞，接受新连接
 		if (ret == ERR_OK)
 		{
-			//连接成功建立，则为其分配子任务堆栈空间
+			//连接成功建立，则为其分配子任务堆栈空间和连接上下文
+			//若堆栈空间已用完，则淘汰最久未活动的连接，为新连接腾出堆栈空间
 			unsigned int i = ModbusStackFind();
-			if (i < MAX_CLIENT_NUM)
+			mb_conn_t *ctx = NULL;
+			if (i >= MAX_CLIENT_NUM)
+				i = ModbusConnEvict();
+
+			if (i < MAX_CLIENT_NUM && (ctx = ModbusPoolAlloc(MBPOOL_CONN)) != NULL)
 			{
+				ctx->conn = newconn;
+				ctx->index = i;
+				ctx->last_active = OSTimeGet();
+				ctx->evict = 0;
+
+				ModbusConnKeepAlive(newconn);
+				netconn_set_recvtimeout(newconn, MB_CLIENT_RECV_POLL);
+
 				//堆栈空间有效，创建子任务
-				INT8U Err = OSTaskCreate(ModbusClientServer,
-										 (void *)newconn,
+				//堆栈在创建时清零，以便统计堆栈使用量
+				INT8U Err = OSTaskCreateExt(ModbusClientServer,
+										 (void *)ctx,
 										 (OS_STK *)&child_stack_areas.stk_area[i][CLIENT_STK_SIZE - 1],
-										 (INT8U)(CLIENT_START_PRIO + i));
+										 (INT8U)(CLIENT_START_PRIO + i),
+										 (INT16U)(CLIENT_START_PRIO + i),
+										 (OS_STK *)&child_stack_areas.stk_area[i][0],
+										 CLIENT_STK_SIZE,
+										 NULL,
+										 OS_TASK_OPT_STK_CHK | OS_TASK_OPT_STK_CLR);
 				if (Err == OS_ERR_NONE)
 				{
 					//若子任务创建成功，则标识堆栈已使用
-					ModubsStackGet(i);
+					ModubsStackGet(i, ctx);
+					ModbusStatsInc(MB_STAT_ACCEPTED);
 					continue;
 				}
+				ModbusPoolFree(MBPOOL_CONN, ctx);
 			}
 
-			//堆栈空间分配失败，或子任务创建失败，则关闭新连接
+			//堆栈空间或连接上下文分配失败，或子任务创建失败，则关闭新连接
 			//由于资源限制（对其空间分配失败），无法响应该连接
+			ModbusStatsInc(MB_STAT_REFUSED);
 			netconn_close(newconn);
 			netconn_delete(newconn);
 			newconn = NULL;
@@ -116,38 +399,64 @@ void ModbusMainServer(void *p_arg)
 //服务器子任务，负责处理单个连接上的请求，并向客户端返回响应
 static void ModbusClientServer(void* p_arg)
 {
-	//获得堆栈区域索引，便于后续释放
-	unsigned int task_index = (OSPrioCur - CLIENT_START_PRIO);
-	struct netconn *newconn = (struct netconn *)p_arg;    //获得连接结构
+	mb_conn_t *ctx = (mb_conn_t *)p_arg;                  //获得连接上下文
+	unsigned int task_index = ctx->index;                 //获得堆栈区域索引，便于后续释放
+	struct netconn *newconn = ctx->conn;                  //获得连接结构
+
+	ModbusStatsConnStart();                               //开始统计本连接上的请求
 
 	while(newconn)
 	{
 		struct netbuf *inbuf = NULL;
-		inbuf = newconn_recv(newconn);    //阻塞接受客户端的请求
+		err_t ret = netconn_recv(newconn, &inbuf);    //接受客户端的请求，最多阻塞MB_CLIENT_RECV_POLL
 
-		if (inbuf != NULL)
+		if (ret == ERR_OK)
 		{
+			ctx->last_active = OSTimeGet();
+
+#if MODBUS_SERVER_ROLE == MB_ROLE_GATEWAY
+			//网关在ModbusRquestHadle内部按需获取串口互斥量，转发到下游Modbus/TCP设备的请求可并发处理
+			ModbusRquestHadle(newconn, inbuf);
+#else
 			//接收到请求，则首先获得资源访问的互斥信号量，再处理请求
 			sys_sem_wait(&mem_sem);
-			eMBServerErrorCode err = ModbusRquestHadle(newconn, inbuf);
+			ModbusRquestHadle(newconn, inbuf);
 			sys_sem_signal(&mem_sem);     //请求处理完毕，释放互斥量
+#endif
 
 			netbuf_delete(inbuf);         //删除客户端数据包
-			if(err == MBS_ERROK)          //服务器不主动断开连接，继续处理后续请求
+
+			//服务器不主动断开连接，继续处理后续请求（处理出错的请求已在统计中记录）；
+			//但已被淘汰的连接即使客户端仍在持续发送请求，也须关闭连接并退出
+			if (!ctx->evict)
 				continue;
+
+			netconn_close(newconn);
+			netconn_delete(newconn);
+			newconn = NULL;
 		}
-		else            //收到客户端的NULL数据包，表明客户端断开连接
+		else if (ret == ERR_TIMEOUT && !ctx->evict
+				 && (OSTimeGet() - ctx->last_active) < MB_MS_TO_TICKS(MB_CLIENT_IDLE_TIMEOUT))
 		{
+			continue;   //接收超时，但连接未空闲超时也未被淘汰，继续等待请求
+		}
+		else            //客户端断开连接、连接出错（含保活失败）、空闲超时或被淘汰
+		{
+			if (ret == ERR_TIMEOUT && !ctx->evict)
+			{
+				ModbusStatsInc(MB_STAT_IDLE_CLOSED);
+			}
+
 			netconn_close(newconn);       //服务器也自动断开本地连接
 			netconn_delete(newconn);
-			netconn = NULL;
+			newconn = NULL;
 		}
 
 
 	}//while
 
-	//子任务退出，释放堆栈区域，并删除任务自身
-	ModbusStacKFree(task_index);
+	//子任务退出，释放连接上下文和堆栈区域，并删除任务自身
+	ModbusStackFree(task_index, ctx);
 	OSTaskDel(OS_PRIO_SELF);
 
 }
@@ -161,4 +470,16 @@ static void ModbusClientServer(void* p_arg)
 */
 
 
-
+//服务器初始化函数，创建服务器主任务（需使能OS_TASK_CREATE_EXT_EN以支持堆栈检查）
+void ModbusServerInit(void)
+{
+	OSTaskCreateExt(ModbusMainServer,
+					NULL,
+					&server_stk_area[MODBUS_SERVER_STK_SIZE - 1],
+					MODBUS_SERVER_PRIO,
+					MODBUS_SERVER_PRIO,
+					&server_stk_area[0],
+					MODBUS_SERVER_STK_SIZE,
+					NULL,
+					OS_TASK_OPT_STK_CHK | OS_TASK_OPT_STK_CLR);
+}
@@ -0,0 +1,26 @@
+#ifndef __MODBUS_TCP_H__
+#define __MODBUS_TCP_H__
+
+/**
+*Modbus/TCP服务器主任务与客户端子任务。每个客户端连接由一个子任务服务，子任务的堆栈区
+*和优先级按堆栈区索引分配：第i个堆栈区上的子任务优先级为CLIENT_START_PRIO + i。
+**/
+
+#define  MAX_CLIENT_NUM    5     //最大子任务数（最大并发数量）
+#define  CLIENT_START_PRIO 15    //各子任务其实优先级
+
+//堆栈使用情况（单位均为字）
+typedef struct mb_stack_usage
+{
+	unsigned short size;        //堆栈大小
+	unsigned short used;        //当前使用量，堆栈区空闲时为0
+	unsigned short used_max;    //使用量高水位
+}mb_stack_usage_t;
+
+void  ModbusServerInit(void);
+
+//查询子任务（index < MAX_CLIENT_NUM）或服务器主任务（index == MAX_CLIENT_NUM）的堆栈使用情况，
+//返回uC/OS错误码（OS_ERR_NONE或OS_ERR_PRIO_INVALID）
+unsigned char ModbusStackUsage(unsigned int index, mb_stack_usage_t *usage);
+
+#endif /* __MODBUS_TCP_H__ */
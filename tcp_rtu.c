@@ -1,20 +1,15 @@
-
-
-//网关服务器内部错误码定义
-typedef enum
-{
-	MBGATE_ERROK = 0,        //无操作
-	MBGATE_BADREQUEST,       //请求不合法
-	MBGATE_BADPROCTOL,       //协议字段校验失败
-	MBGATE_ERRSENDRTU,       //发送RTU帧失败
-	MBGATE_ERRRECVRTU,       //接收RTU帧失败
-	MBGATE_BADCRC            //RTU帧校验失败
-}eMBGATEErrorCode;
-
+#include "mb_pool.h"
+#include "tcp_rtu.h"
+#include "tcp_tcp.h"
+#include "mb_stats.h"
+#include "mb_capture.h"
 
 //用于串口访问的互斥信号量
 static sys_sem_t usart_sem;
 
+//正在等待或占用串口的请求数，即总线排队深度，在SYS_ARCH_PROTECT保护下修改
+static unsigned int usart_queue;
+
 //RTU帧中地址域最大取值
 #define  MODBUSTCP_ADDRESS_MAX   (247)
 
@@ -31,6 +26,326 @@ static unsigned char TCPSendReceiveBuf[MB_USART_BUF_SIZE];
 //FreeModbus内部处理ModbusRTU帧的缓冲区，在mbrtu.c中定义
 extern unsigned char ucRTUBuf[];
 
+//网关内部错误码对应的统计项
+static const eMBStatId MBGATEErrorStat[] =
+{
+	MB_STAT_MAX,               //MBGATE_ERROK，不计入错误统计
+	MB_STAT_ERR_BADREQUEST,    //MBGATE_BADREQUEST
+	MB_STAT_ERR_BADPROCTOL,    //MBGATE_BADPROCTOL
+	MB_STAT_ERR_SENDRTU,       //MBGATE_ERRSENDRTU
+	MB_STAT_ERR_RECVRTU,       //MBGATE_ERRRECVRTU
+	MB_STAT_ERR_BADCRC,        //MBGATE_BADCRC
+	MB_STAT_ERR_NOMEM,         //MBGATE_ERRNOMEM
+	MB_STAT_ERR_NOCONN,        //MBGATE_ERRNOCONN
+	MB_STAT_ERR_SENDTCP,       //MBGATE_ERRSENDTCP
+	MB_STAT_ERR_RECVTCP,       //MBGATE_ERRRECVTCP
+	MB_STAT_ERR_SEND,          //MBGATE_ERRSEND
+};
+
+//标准响应中最多容纳的寄存器数量
+#define  MB_RTU_REGS_PER_RSP  125
+
+//从站单次读取寄存器数量上限表
+static const struct
+{
+	unsigned char  uid_first;
+	unsigned char  uid_last;
+	unsigned short max;
+}MBRtuReadMax[] =
+{
+#define  MB_RTU_READ_MAX_ENTRY(first, last, max)   {(first), (last), (max)},
+	MB_RTU_READ_MAX_TABLE(MB_RTU_READ_MAX_ENTRY)
+#undef   MB_RTU_READ_MAX_ENTRY
+	{0, 0, 0}
+};
+
+//扩展读取所允许的最大寄存器数量，MB_RTU_SPLIT_QTY_MAX不超过125时即关闭扩展读取
+#define  MB_RTU_SPLIT_LIMIT   ((MB_RTU_SPLIT_QTY_MAX > MB_RTU_REGS_PER_RSP) ? MB_RTU_SPLIT_QTY_MAX : MB_RTU_REGS_PER_RSP)
+
+//查询从站单次读取寄存器数量上限：表项优先，其次为MB_RTU_READ_MAX，结果不超过一个标准响应所能容纳的数量
+static unsigned short ModbusGateReadMax(unsigned char uid)
+{
+	unsigned short max = MB_RTU_READ_MAX;
+	unsigned int i;
+
+	for (i = 0; i < sizeof(MBRtuReadMax) / sizeof(MBRtuReadMax[0]) - 1; i++)
+	{
+		if (uid >= MBRtuReadMax[i].uid_first && uid <= MBRtuReadMax[i].uid_last
+			&& MBRtuReadMax[i].max > 0)
+		{
+			max = MBRtuReadMax[i].max;
+			break;
+		}
+	}
+
+	return (max < MB_RTU_REGS_PER_RSP) ? max : MB_RTU_REGS_PER_RSP;
+}
+
+/**
+*在RS485上完成一次RTU事务：发送请求并等待响应，调用者需已获得usart_sem
+*uid:从站地址；pdu:请求PDU；pdulen:请求PDU长度
+*addr:返回响应的地址域；rsp:返回响应PDU起始地址（位于FreeModbus的ucRTUBuf中）；rsplen:返回响应PDU长度
+*返回值：成功返回MBGATE_ERROK，广播请求发送后即返回，此时rsplen为0
+*/
+static eMBGATEErrorCode ModbusGateRtuTransact(unsigned char uid, const unsigned char *pdu, unsigned short pdulen,
+	unsigned char *addr, unsigned char **rsp, unsigned short *rsplen)
+{
+	eMBErrorCode err;
+	eMBEventType eEvent;
+	unsigned char trytimes = 0;
+
+	*rsplen = 0;
+
+	//将Modbus/RTU帧（地址域加PDU）拷贝到ucRTUBuf中
+	ucRTUBuf[0] = uid;
+	memcpy(&ucRTUBuf[1], pdu, pdulen);
+
+	//发送Modbus/RTU帧，该函数将自动添加CRC
+	err = eMBRTUSend(uid, &ucRTUBuf[1], pdulen);
+	if (err != MB_ENOERR)
+	{
+		return MBGATE_ERRSENDRTU;
+	}
+	ModbusCaptureRecord(MB_CAP_RTU_REQ, ucRTUBuf, pdulen + 1);
+
+	//若是广播请求，则无需等待响应
+	if (uid == 0)
+	{
+		return MBGATE_ERROK;
+	}
+
+	//循环检测串口数据是否就绪
+	do{
+		OSTimeDlyHMSM(0, 0, 0, TRY_TIME_INTERVAL);
+
+		if(xMBPortEventGet(&eEvent) == TRUE)
+			break;
+		trytimes++;
+	}while(trytimes < TRY_MAX_NUM);    //尝试多次接收串口的数据
+
+	if(trytimes == TRY_MAX_NUM || eEvent != EV_FRAME_RECEIVED)
+	{
+		//在多次尝试后扔未接收到响应，则接收失败
+		return MBGATE_ERRRECVRTU;
+	}
+
+	//接收RTU响应成功，则读取数据，其中rsp表示PDU的起始地址，而addr则表示RTU ADU地址域
+	err = eMBRTUReceive(addr, rsp, rsplen);
+	if(err != MB_ENOERR)
+	{
+		return MBGATE_BADCRC;
+	}
+
+	//FreeModbus将地址域和PDU连续存放在ucRTUBuf中
+	ModbusCaptureRecord(MB_CAP_RTU_RSP, ucRTUBuf, *rsplen + 1);
+
+	return MBGATE_ERROK;
+}
+
+//向客户端返回buf中的响应，pdulen为响应PDU长度，TID和UID由调用者填写
+static eMBGATEErrorCode ModbusGateReply(struct netconn *conn, unsigned char *buf, unsigned short pdulen)
+{
+	buf[LWIP_TCP_PID] = 0;
+	buf[LWIP_TCP_PID + 1] = 0;
+	buf[LWIP_TCP_LEN] = (pdulen + 1) >> 8U;	//加1为单元标识符字节（地址域)1个字节
+	buf[LWIP_TCP_LEN + 1] = (pdulen + 1) & 0xFF;
+
+	//发送Modbus/TCP响应给客户端，拷贝方式发送
+	if (netconn_write(conn, buf, pdulen + LWIP_TCP_FUNC, NETCONN_COPY) != ERR_OK)
+	{
+		return MBGATE_ERRSEND;
+	}
+
+	ModbusStatsInc(MB_STAT_RESPONSE);
+	ModbusStatsAdd(MB_STAT_TX_BYTES, pdulen + LWIP_TCP_FUNC);
+	ModbusCaptureRecord(MB_CAP_TCP_RSP, buf, pdulen + LWIP_TCP_FUNC);
+	if (buf[LWIP_TCP_FUNC] & 0x80)     //从站返回了异常响应
+	{
+		ModbusStatsInc(MB_STAT_EXCEPTION);
+	}
+
+	return MBGATE_ERROK;
+}
+
+/**
+*拆分读取中止：从第seg段到最后一段（共nseg段），以各段的TID依次返回异常响应，
+*使客户端的每个TID都得到应答，而不是在已收到的几段之后再也收不到响应
+*/
+static eMBGATEErrorCode ModbusGateSplitAbort(struct netconn *conn, unsigned short tid, unsigned char func,
+	unsigned short seg, unsigned short nseg, unsigned char exception)
+{
+	eMBGATEErrorCode processflag = MBGATE_ERROK;
+
+	for (; seg < nseg && processflag == MBGATE_ERROK; seg++)
+	{
+		TCPSendReceiveBuf[LWIP_TCP_TID] = (unsigned short)(tid + seg) >> 8U;
+		TCPSendReceiveBuf[LWIP_TCP_TID + 1] = (unsigned short)(tid + seg) & 0xFF;
+		TCPSendReceiveBuf[LWIP_TCP_FUNC] = func | 0x80;
+		TCPSendReceiveBuf[LWIP_TCP_FUNC + 1] = exception;
+		processflag = ModbusGateReply(conn, TCPSendReceiveBuf, 2);
+	}
+
+	return processflag;
+}
+
+/**
+*拆分读取：按从站单次读取上限将FC3/FC4请求拆分为多次RTU读取，在持有usart_sem期间连续完成。
+*寄存器数量不超过125时合并为一个响应；超过125时每125个寄存器返回一个响应，TID依次加1。
+*任一次读取返回异常时，当前段及其后各段都返回该异常；任一次读取失败（如从站超时）时，
+*当前段及其后各段都返回网关异常0x0B（目标设备无响应），已返回的各段保持有效。
+*conn:客户端连接；uid:从站地址；func:功能码；start:起始地址；qty:寄存器数量；readmax:从站单次读取上限
+*/
+static eMBGATEErrorCode ModbusGateSplitRead(struct netconn *conn, unsigned char uid, unsigned char func,
+	unsigned short start, unsigned short qty, unsigned short readmax)
+{
+	unsigned short tid = (TCPSendReceiveBuf[LWIP_TCP_TID] << 8U) + TCPSendReceiveBuf[LWIP_TCP_TID+1];
+	unsigned short done = 0, got, segqty, n, seg = 0;
+	unsigned short nseg = (qty + MB_RTU_REGS_PER_RSP - 1) / MB_RTU_REGS_PER_RSP;
+	unsigned char pdu[5];
+	unsigned char addr, *rsp;
+	unsigned short rsplen;
+	eMBGATEErrorCode processflag;
+
+	while (done < qty)
+	{
+		segqty = (qty - done > MB_RTU_REGS_PER_RSP) ? MB_RTU_REGS_PER_RSP : (qty - done);
+
+		//本段响应的MBAP帧头，数据区由各次RTU读取的结果拼接而成
+		TCPSendReceiveBuf[LWIP_TCP_TID] = (unsigned short)(tid + seg) >> 8U;
+		TCPSendReceiveBuf[LWIP_TCP_TID + 1] = (unsigned short)(tid + seg) & 0xFF;
+		TCPSendReceiveBuf[LWIP_TCP_UID] = uid;
+		TCPSendReceiveBuf[LWIP_TCP_FUNC] = func;
+		TCPSendReceiveBuf[LWIP_TCP_FUNC + 1] = (unsigned char)(segqty * 2);
+
+		for (got = 0; got < segqty; got += n)
+		{
+			n = (segqty - got > readmax) ? readmax : (segqty - got);
+
+			pdu[0] = func;
+			pdu[1] = (unsigned short)(start + done + got) >> 8U;
+			pdu[2] = (unsigned short)(start + done + got) & 0xFF;
+			pdu[3] = n >> 8U;
+			pdu[4] = n & 0xFF;
+
+			processflag = ModbusGateRtuTransact(uid, pdu, sizeof(pdu), &addr, &rsp, &rsplen);
+			if (processflag != MBGATE_ERROK)
+			{
+				//记录原错误，应答失败时以发送错误为准
+				if (ModbusGateSplitAbort(conn, tid, func, seg, nseg, MB_EX_GATEWAY_TGT_FAILED) != MBGATE_ERROK)
+					processflag = MBGATE_ERRSEND;
+				return processflag;
+			}
+
+			//从站返回异常，或响应长度与请求不符（按从站故障处理），返回异常响应
+			if ((rsp[0] & 0x80) || rsplen != 2 + n * 2 || rsp[1] != n * 2)
+			{
+				return ModbusGateSplitAbort(conn, tid, func, seg, nseg,
+					(rsp[0] & 0x80) ? rsp[1] : MB_EX_SLAVE_DEVICE_FAILURE);
+			}
+
+			memcpy(&TCPSendReceiveBuf[LWIP_TCP_FUNC + 2 + got * 2], &rsp[2], n * 2);
+		}
+
+		processflag = ModbusGateReply(conn, TCPSendReceiveBuf, 2 + segqty * 2);
+		if (processflag != MBGATE_ERROK)
+		{
+			return processflag;
+		}
+
+		done += segqty;
+		seg++;
+	}
+
+	return MBGATE_ERROK;
+}
+
+/**
+*处理发往网关自身（MB_GATE_LOCAL_UID）的请求：FC8诊断子功能，以及FC4读取统计保留区，
+*使网关自身的统计计数（包括各MBGATE_*错误）可以通过Modbus/TCP读取。
+*响应在帧缓冲中构造，不占用串口和TCPSendReceiveBuf，总线繁忙时也能及时响应
+*conn:客户端连接；req、len:来自客户端的Modbus/TCP请求
+*/
+static eMBGATEErrorCode ModbusGateLocal(struct netconn *conn, const unsigned char *req, u16_t len)
+{
+	mb_frame_t *frame;
+	unsigned char *pdu;
+	unsigned short usPID, usLength, pdulen, usStart, usQty, usValue, i;
+	eMBException eException = MB_EX_NONE;
+	eMBGATEErrorCode processflag;
+
+	usPID = (req[LWIP_TCP_PID] << 8U) + req[LWIP_TCP_PID+1];
+	usLength = (req[LWIP_TCP_LEN] << 8U) + req[LWIP_TCP_LEN+1];
+	if (usPID != MODBUSTCP_PROTOCOL_ID || (usLength + LWIP_TCP_UID) != len)
+	{
+		return MBGATE_BADPROCTOL;
+	}
+
+	frame = ModbusPoolAlloc(MBPOOL_FRAME);
+	if (frame == NULL)
+	{
+		return MBGATE_ERRNOMEM;
+	}
+
+	memcpy(frame->buf, req, len);
+	pdu = &frame->buf[LWIP_TCP_FUNC];
+	pdulen = len - LWIP_TCP_FUNC;
+
+	switch (pdu[0])
+	{
+	case MB_FUNC_DIAG_DIAGNOSTIC:
+		eException = eMBFuncDiagnostics(pdu, &pdulen);
+		break;
+
+	case MB_FUNC_READ_INPUT_REGISTER:
+		if (pdulen != 5)
+		{
+			eException = MB_EX_ILLEGAL_DATA_VALUE;
+			break;
+		}
+
+		//PDU中的寄存器地址从0开始，统计保留区地址与FreeModbus一致，从1开始
+		usStart = ((pdu[1] << 8U) | pdu[2]) + 1;
+		usQty = (pdu[3] << 8U) | pdu[4];
+		if (usQty < 1 || usQty > MB_RTU_REGS_PER_RSP)
+		{
+			eException = MB_EX_ILLEGAL_DATA_VALUE;
+			break;
+		}
+		if (usStart < MB_STATS_REG_START || usStart + usQty > MB_STATS_REG_START + MB_STATS_REG_NUM)
+		{
+			eException = MB_EX_ILLEGAL_DATA_ADDRESS;
+			break;
+		}
+
+		pdu[1] = (unsigned char)(usQty * 2);
+		for (i = 0; i < usQty; i++)
+		{
+			ModbusStatsRegRead(usStart + i, &usValue, MB_REG_READ);
+			pdu[2 + i * 2] = (unsigned char)(usValue >> 8);
+			pdu[3 + i * 2] = (unsigned char)(usValue & 0xFF);
+		}
+		pdulen = 2 + usQty * 2;
+		break;
+
+	default:
+		eException = MB_EX_ILLEGAL_FUNCTION;
+		break;
+	}
+
+	//构造异常响应
+	if (eException != MB_EX_NONE)
+	{
+		pdu[0] |= 0x80;
+		pdu[1] = eException;
+		pdulen = 2;
+	}
+
+	processflag = ModbusGateReply(conn, frame->buf, pdulen);
+	ModbusPoolFree(MBPOOL_FRAME, frame);
+
+	return processflag;
+}
+
 /**
 *将Modbus/TCP请求转换为Modbus/RTU请求并发送到串行链路上，同时等待Modbus/RTU响应返回，
 *并将其转化为Modbus/TCP响应并返回给客户端。
@@ -42,7 +357,6 @@ eMBGATEErrorCode ModbusRquestHadle(struct netconn *conn, struct netbuf *inbuf)
 	unsigned char *dataptr = NULL;
 	u16_t  datasize = 0;
 	eMBGATEErrorCode processflag = MBGATE_ERROK;
-	eMBErrorCode  err=MB_ENOERR;
 
 	//Modbus/TCP请求MBAP帧头各个字段值
 	unsigned int usPID    = 0;
@@ -50,17 +364,23 @@ eMBGATEErrorCode ModbusRquestHadle(struct netconn *conn, struct netbuf *inbuf)
 	unsigned char usUID   = 0;
 	unsigned char usFUN   = 0;
 
-	//用于串口状态查询的变量
-	eMBEventType eEvent;
-	unsigned char trytimes = 0;
+	//FC3/FC4读请求的起始地址、寄存器数量及从站单次读取上限
+	unsigned short usStart, usQty, usReadMax;
 
 	//接收到的Modbus/RTU帧
 	unsigned char *PDUStartAddr = NULL;		//RTU PDU起始地址
 	unsigned char RTURcvAddress;            //RTU ADU地址域
 	unsigned short PDULength;               //RTU PDU长度
 
+	unsigned char locked = 0;       //是否已获得串口互斥信号量
+	SYS_ARCH_DECL_PROTECT(lev);
+
 	netbuf_data(inbuf,&dataptr,&datasize);
 
+	ModbusStatsInc(MB_STAT_REQUEST);
+	ModbusStatsAdd(MB_STAT_RX_BYTES, datasize);
+	ModbusCaptureRecord(MB_CAP_TCP_REQ, dataptr, datasize);
+
 	do
 	{
 		//校验Modbus/TCP请求帧数据长度
@@ -70,6 +390,27 @@ eMBGATEErrorCode ModbusRquestHadle(struct netconn *conn, struct netbuf *inbuf)
 			break;
 		}
 
+		//发往网关自身的请求在本地处理
+		if (dataptr[LWIP_TCP_UID] == MB_GATE_LOCAL_UID)
+		{
+			processflag = ModbusGateLocal(conn, dataptr, datasize);
+			break;
+		}
+
+		//单元标识符对应下游Modbus/TCP设备时，转发到下游设备，不占用串口
+		if (ModbusTcpGateRoute(dataptr[LWIP_TCP_UID]) != NULL)
+		{
+			processflag = ModbusTcpGateForward(conn, dataptr, datasize);
+			break;
+		}
+
+		//RTU转发使用串口和内部缓冲区，需先获得串口互斥信号量
+		SYS_ARCH_PROTECT(lev);
+		usart_queue++;
+		SYS_ARCH_UNPROTECT(lev);
+		sys_sem_wait(&usart_sem);
+		locked = 1;
+
 		//拷贝至内部缓冲区中以便对数据进行操作
 		memcpy(TCPSendReceiveBuf,dataptr,datasize);
 
@@ -87,71 +428,81 @@ eMBGATEErrorCode ModbusRquestHadle(struct netconn *conn, struct netbuf *inbuf)
 				break;
 		}
 
-		//将Modbus/RTU拷贝到ucRTUBuf中
-		memcpy(ucRTUBuf,$TCPSendReceiveBuf[LWIP_TCP_UID],usLength);
-
-		//2.发送Modbus/RTU帧，该函数将自动添加CRC
-		err = eMBRTUSend(usUID,&ucRTUBuf[1],usLength-1);
-		if (err != MB_ENOERR)
-		{
-			processflag = MBGATE_ERRSENDRTU;
-			break;
-		}
-
-		//3.发送成功后，等到Modbus/RTU响应
-		if (usUID == 0)	 //若是广播请求，则无需等待响应
+		//FC3/FC4读取的寄存器数量超过从站单次读取上限时，拆分为多次RTU读取
+		if ((usFUN == MB_FUNC_READ_HOLDING_REGISTER || usFUN == MB_FUNC_READ_INPUT_REGISTER)
+			&& usUID != 0 && usLength == 6)
 		{
-			break;
-		}
-
-		//循环检测串口数据是否就绪
-		do{
-			OSTimeDlyHMSM(0, 0, 0, TRY_TIME_INTERVAL);
-
-			if(xMBPortEventGet(&eEvent) == TRUE)
+			usStart = (TCPSendReceiveBuf[LWIP_TCP_FUNC+1] << 8U) + TCPSendReceiveBuf[LWIP_TCP_FUNC+2];
+			usQty = (TCPSendReceiveBuf[LWIP_TCP_FUNC+3] << 8U) + TCPSendReceiveBuf[LWIP_TCP_FUNC+4];
+			usReadMax = ModbusGateReadMax(usUID);
+			if (usQty > usReadMax && usQty <= MB_RTU_SPLIT_LIMIT)
+			{
+				processflag = ModbusGateSplitRead(conn, usUID, usFUN, usStart, usQty, usReadMax);
 				break;
-			trytimes++;
-		}while(trytimes < TRY_MAX_NUM);    //尝试多次接收串口的数据
+			}
+		}
 
-		if(trytimes == TRY_MAX_NUM || eEvent != EV_FRAME_RECEIVED)
+		//2.发送Modbus/RTU帧，3.发送成功后，等到Modbus/RTU响应
+		processflag = ModbusGateRtuTransact(usUID, &TCPSendReceiveBuf[LWIP_TCP_FUNC], usLength - 1,
+			&RTURcvAddress, &PDUStartAddr, &PDULength);
+		if (processflag != MBGATE_ERROK)
 		{
-			//在多次尝试后扔未接收到响应，则接收失败
-			processflag = MBGATE_ERRRECVRTU;
 			break;
 		}
 
-
-		//接收RTU响应成功，则读取数据，其中PDUStartAddr表示PDU的起始地址，
-		//而RTURcvAddress则表示RTU ADU地址域
-		//eMBRTUReceive
-		err = eMBRTUReceive(&RTURcvAddress,&PDUStartAddr,&PDULength);
-
-		if(err != MB_ENOERR)
+		if (usUID == 0)	 //若是广播请求，则无需等待响应
 		{
-			processflag = MBGATE_BADCRC;
+			ModbusStatsInc(MB_STAT_NORESPONSE);
 			break;
 		}
 
 		//4.将Modbus/RTU转化为Modbus/TCP帧
-		TCPSendReceiveBuf[LWIP_TCP_LEN] = (PDULength + 1) >> 8U;	//加1为单元标识符字节（地址域)1个字节
-		TCPSendReceiveBuf[LWIP_TCP_LEN + 1] = (PDULength + 1) & 0xFF;
 		TCPSendReceiveBuf[LWIP_TCP_UID] = RTURcvAddress;			//为单元标识符赋值，对应RTU的地址域
 		memcpy(&TCPSendReceiveBuf[LWIP_TCP_FUNC],PDUStartAddr,PDULength);  //LWIP_TCP_FUNC为7，从功能码开始拷贝
 
-		//5.发送Modbus/TCP响应给客户端，拷贝方式发送
-		netconn_write(conn, TCPSendReceiveBuf,PDULength + LWIP_TCP_FUNC, NETCONN_COPY);
-
+		//5.发送Modbus/TCP响应给客户端
+		processflag = ModbusGateReply(conn, TCPSendReceiveBuf, PDULength);
 
 	}while(0);
 
+	//总线事务结束，释放串口
+	if (locked)
+	{
+		sys_sem_signal(&usart_sem);
+		SYS_ARCH_PROTECT(lev);
+		usart_queue--;
+		SYS_ARCH_UNPROTECT(lev);
+	}
+
+	//记录处理错误
+	if (processflag != MBGATE_ERROK)
+	{
+		ModbusStatsInc(MBGATEErrorStat[processflag]);
+	}
 
 	//返回处理结果
 	return processflag;
 
 }
 
-/**子任务在调用ModbusRquestHadle处理Modbus/TCP请求之前，必须先获取信号量usart_sem,从而保证对RS485接口的独占访问
+//查询RS485总线上排队的请求数
+unsigned int ModbusGateBusQueue(void)
+{
+	return usart_queue;
+}
+
+//网关初始化：创建串口互斥信号量，启动下游Modbus/TCP连接
+void ModbusGateInit(void)
+{
+	sys_sem_new(&usart_sem, 1);
+	ModbusTcpGateInit();
+}
+
+/**ModbusRquestHadle在使用RS485接口之前先获取信号量usart_sem,从而保证对RS485接口的独占访问，而转发到下游
+*Modbus/TCP设备的请求不占用该信号量，因此网关服务器的子任务调用ModbusRquestHadle时无需再获取mem_sem。
 *上面几个重要函数是在移植FreeModbus中完成的：一是RTU帧发送函数eMBRTUSend,该函数会将MBAP的单元标识字段usUID封装到
 *串行链路Modbus/RTU数据帧的地址域中，添加CRC校验字段构造完整的RTU数据帧发送出去；在等待读取串行链路服务器的响应时，
 *使用的是xMBPortEventGet函数来检测串口状态机，若FreeModbus成功接收到了响应，eMBRTUReceive函数将被调用来读取响应帧。
+*这一发送、等待、接收的过程封装在ModbusGateRtuTransact中，拆分读取时在持有usart_sem期间连续调用多次，
+*其间其他客户端的请求不会插入到RS485总线上。
 */
\ No newline at end of file
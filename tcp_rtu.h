@@ -0,0 +1,68 @@
+#ifndef __TCP_RTU_H__
+#define __TCP_RTU_H__
+
+//MBAP帧头各字段的偏移值（与modbus_p.c中的定义相同）
+#ifndef LWIP_TCP_TID
+#define  LWIP_TCP_TID    0       //事务标识符
+#define  LWIP_TCP_PID    2       //协议标识符
+#define  LWIP_TCP_LEN    4       //长度
+#define  LWIP_TCP_UID    6       //设备标识符
+#define  LWIP_TCP_FUNC   7       //功能码
+
+#define  MODBUSTCP_PROTOCOL_ID    0     //协议标识符， 0 = Modbus协议
+#endif
+
+//网关服务器内部错误码定义
+typedef enum
+{
+	MBGATE_ERROK = 0,        //无操作
+	MBGATE_BADREQUEST,       //请求不合法
+	MBGATE_BADPROCTOL,       //协议字段校验失败
+	MBGATE_ERRSENDRTU,       //发送RTU帧失败
+	MBGATE_ERRRECVRTU,       //接收RTU帧失败
+	MBGATE_BADCRC,           //RTU帧校验失败
+	MBGATE_ERRNOMEM,         //事务对象分配失败
+	MBGATE_ERRNOCONN,        //没有可用的下游Modbus/TCP连接
+	MBGATE_ERRSENDTCP,       //向下游Modbus/TCP设备发送请求失败
+	MBGATE_ERRRECVTCP,       //等待下游Modbus/TCP设备响应超时
+	MBGATE_ERRSEND           //向客户端返回响应失败
+}eMBGATEErrorCode;
+
+/**
+*从站单次读取寄存器数量上限表：UID起始值、UID结束值、上限。部分从站一次只能读取少于125个寄存器，
+*网关将FC3/FC4读请求按上限拆分为多次RTU读取后再合并。未列出的从站使用MB_RTU_READ_MAX，
+*表项的上限优先于MB_RTU_READ_MAX（可大于或小于它），两者都不超过125。例如：
+*#define MB_RTU_READ_MAX_TABLE(X) \
+*	X(1, 10, 32) \
+*	X(20, 20, 64)
+*/
+#ifndef MB_RTU_READ_MAX_TABLE
+#define  MB_RTU_READ_MAX_TABLE(X)
+#endif
+#ifndef MB_RTU_READ_MAX
+#define  MB_RTU_READ_MAX           125
+#endif
+
+/**
+*扩展读取：FC3/FC4请求的寄存器数量超过125（一个响应所能容纳的最大值）但不超过MB_RTU_SPLIT_QTY_MAX时，
+*网关按125个寄存器一段依次返回多个标准响应，第k段（从0开始）响应的TID为请求TID加k。
+*客户端在收齐全部响应之前不应使用这些TID发送其他请求。某一段读取失败时，该段及其后各段都以异常响应应答。
+*扩展读取不是标准行为，默认关闭（0），此时超过125个寄存器的请求照常转发给从站，由从站返回异常码03。
+*/
+#ifndef MB_RTU_SPLIT_QTY_MAX
+#define  MB_RTU_SPLIT_QTY_MAX      0
+#endif
+
+//网关自身的单元标识符：FC8诊断和FC4读取统计保留区（见mb_stats.h）在网关本地处理，不转发到从站。
+//默认0xFF在RTU地址范围（1~247）之外，若配置为RTU地址，则该地址上的从站将无法访问
+#ifndef MB_GATE_LOCAL_UID
+#define  MB_GATE_LOCAL_UID         0xFF
+#endif
+
+//网关初始化，在服务器主任务启动时调用
+void ModbusGateInit(void);
+
+//查询RS485总线上排队（正在等待或占用串口）的请求数
+unsigned int ModbusGateBusQueue(void);
+
+#endif /* __TCP_RTU_H__ */
@@ -0,0 +1,378 @@
+/*
+*Modbus/TCP到Modbus/TCP网关转发的实现。
+*
+*每条下游连接由一个接收任务负责建立、重连和接收响应；客户端子任务在调用ModbusRquestHadle
+*时直接在下游连接上发送请求，然后在本事务的信号量上等待响应，因此多个客户端的请求可以同时
+*挂起在同一条下游连接上。改写后的TID高字节为事务对象在内存池中的序号，低字节为序列号，
+*接收任务据此以O(1)的代价找到响应对应的事务。
+*/
+
+#include <string.h>
+#include "lwip/sys.h"
+#include "lwip/api.h"
+#include "mb_pool.h"
+#include "tcp_tcp.h"
+#include "mb_stats.h"
+#include "mb_capture.h"
+
+#if MBPOOL_TRANS_NUM > 256
+#error "MBPOOL_TRANS_NUM must not exceed 256, the rewritten TID keeps the transaction index in one byte"
+#endif
+
+#define  MB_TCPGATE_ROUTE_ENTRY(first, last, a, b, c, d, port)  { (first), (last), { (a), (b), (c), (d) }, (port) },
+#define  MB_TCPGATE_ROUTE_COUNT(first, last, a, b, c, d, port)  + 1
+
+//路由表，最后一项为结束标志
+static const mb_tcpgate_route_t tcpgate_routes[] =
+{
+	MB_TCPGATE_ROUTE_TABLE(MB_TCPGATE_ROUTE_ENTRY)
+	{ 0, 0, { 0, 0, 0, 0 }, 0 }
+};
+
+#define  MB_TCPGATE_ROUTE_NUM  (0 MB_TCPGATE_ROUTE_TABLE(MB_TCPGATE_ROUTE_COUNT))
+
+//下游连接在接收任务和客户端子任务中同时收发，见tcp_tcp.h
+#if MB_TCPGATE_ROUTE_NUM > 0 && !LWIP_TCPIP_CORE_LOCKING
+#error "Modbus/TCP forwarding needs LWIP_TCPIP_CORE_LOCKING to send and receive on one netconn from different tasks"
+#endif
+
+//下游连接
+typedef struct mb_upstream
+{
+	const mb_tcpgate_route_t *route;           //对应的路由表项
+	struct netconn *conn;                      //连接结构，为NULL表示连接尚未建立，在lock和SYS_ARCH_PROTECT保护下修改
+	sys_sem_t       lock;                      //发送互斥量，同时保护conn的建立与删除
+	unsigned int    pending;                   //已发送但尚未收到响应的请求数，在SYS_ARCH_PROTECT保护下修改
+	unsigned char   rxbuf[MBPOOL_FRAME_SIZE];  //响应帧重组缓冲区，一个TCP报文段中可能有多个或半个响应帧
+	unsigned short  rxlen;
+}mb_upstream_t;
+
+//所有下游连接，加1是为了避免路由表为空时数组长度为0
+static mb_upstream_t tcpgate_upstreams[MB_TCPGATE_ROUTE_NUM * MB_TCPGATE_CONN_NUM + 1];
+
+//挂起的转发事务、完成信号量及改写TID用的序号，以事务对象在内存池中的序号为下标。
+//序号按事务对象分别递增，同一事务对象要再被使用256次，超时事务的迟到响应才可能与新事务的TID相同
+static mb_trans_t   *tcpgate_pending[MBPOOL_TRANS_NUM];
+static sys_sem_t     tcpgate_done[MBPOOL_TRANS_NUM];
+static unsigned char tcpgate_seq[MBPOOL_TRANS_NUM];
+
+//查找单元标识符对应的路由表项，UID不在路由表中则返回NULL
+const mb_tcpgate_route_t *ModbusTcpGateRoute(unsigned char uid)
+{
+	unsigned int i;
+
+	for (i = 0; i < MB_TCPGATE_ROUTE_NUM; i++)
+	{
+		if (uid >= tcpgate_routes[i].uid_first && uid <= tcpgate_routes[i].uid_last)
+			return &tcpgate_routes[i];
+	}
+
+	return NULL;
+}
+
+//在路由表项对应的下游连接中，选择已建立且挂起请求最少的一条
+//须在SYS_ARCH_PROTECT临界区内调用，以读取一致的conn和pending
+static mb_upstream_t *ModbusTcpGateSelect(const mb_tcpgate_route_t *route)
+{
+	mb_upstream_t *up = &tcpgate_upstreams[(route - tcpgate_routes) * MB_TCPGATE_CONN_NUM];
+	mb_upstream_t *best = NULL;
+	unsigned int i;
+
+	for (i = 0; i < MB_TCPGATE_CONN_NUM; i++, up++)
+	{
+		if (up->conn != NULL && (best == NULL || up->pending < best->pending))
+			best = up;
+	}
+
+	return best;
+}
+
+//将下游响应交给等待该响应的客户端子任务，找不到对应事务（如已超时）的响应被丢弃。
+//除TID和下游连接外还核对UID和功能码（不计异常位），迟到的响应不会交给碰巧TID相同的其他请求
+static void ModbusTcpGateDeliver(mb_upstream_t *up, const unsigned char *rsp, unsigned short len)
+{
+	unsigned short tid = (rsp[LWIP_TCP_TID] << 8U) + rsp[LWIP_TCP_TID+1];
+	unsigned int idx = tid >> 8;
+	mb_trans_t *trans = NULL;
+	SYS_ARCH_DECL_PROTECT(lev);
+
+	if (idx >= MBPOOL_TRANS_NUM)
+	{
+		return;
+	}
+
+	SYS_ARCH_PROTECT(lev);
+	if (tcpgate_pending[idx] != NULL && tcpgate_pending[idx]->up_tid == tid
+		&& tcpgate_pending[idx]->upstream == up
+		&& tcpgate_pending[idx]->uid == rsp[LWIP_TCP_UID]
+		&& tcpgate_pending[idx]->func == (rsp[LWIP_TCP_FUNC] & 0x7F))
+	{
+		trans = tcpgate_pending[idx];
+		tcpgate_pending[idx] = NULL;
+		up->pending--;
+	}
+	SYS_ARCH_UNPROTECT(lev);
+
+	if (trans != NULL)
+	{
+		memcpy(trans->frame->buf, rsp, len);
+		trans->frame->len = len;
+		sys_sem_signal(&tcpgate_done[idx]);
+	}
+}
+
+//从重组缓冲区中取出完整的响应帧并逐个交付，帧长度不合法时返回ERR_VAL
+static err_t ModbusTcpGateParse(mb_upstream_t *up)
+{
+	unsigned short usLength, framelen;
+
+	while (up->rxlen >= LWIP_TCP_UID)
+	{
+		usLength = (up->rxbuf[LWIP_TCP_LEN] << 8U) + up->rxbuf[LWIP_TCP_LEN+1];
+		framelen = usLength + LWIP_TCP_UID;
+		if (usLength < 2 || framelen > MBPOOL_FRAME_SIZE)
+		{
+			return ERR_VAL;
+		}
+		if (up->rxlen < framelen)
+		{
+			break;    //响应帧尚未接收完整
+		}
+
+		ModbusTcpGateDeliver(up, up->rxbuf, framelen);
+
+		up->rxlen -= framelen;
+		memmove(up->rxbuf, &up->rxbuf[framelen], up->rxlen);
+	}
+
+	return ERR_OK;
+}
+
+//下游连接接收任务，负责建立和重建下游连接，并接收下游设备的响应
+static void ModbusTcpGateThread(void *arg)
+{
+	mb_upstream_t *up = (mb_upstream_t *)arg;
+	struct netconn *conn;
+	struct netbuf *inbuf;
+	struct ip_addr addr;
+	u16_t total, offset, n;
+	err_t err;
+	SYS_ARCH_DECL_PROTECT(lev);
+
+	IP4_ADDR(&addr, up->route->ip[0], up->route->ip[1], up->route->ip[2], up->route->ip[3]);
+
+	while(1)
+	{
+		//建立到下游设备的持久连接
+		conn = netconn_new(NETCONN_TCP);
+		if (conn == NULL || netconn_connect(conn, &addr, up->route->port) != ERR_OK)
+		{
+			if (conn != NULL)
+				netconn_delete(conn);
+			sys_msleep(MB_TCPGATE_RECONNECT);
+			continue;
+		}
+
+		up->rxlen = 0;
+		sys_sem_wait(&up->lock);
+		SYS_ARCH_PROTECT(lev);
+		up->conn = conn;
+		SYS_ARCH_UNPROTECT(lev);
+		sys_sem_signal(&up->lock);
+
+		//循环接收响应，直到连接断开或收到无法解析的数据
+		while ((err = netconn_recv(conn, &inbuf)) == ERR_OK)
+		{
+			total = netbuf_len(inbuf);
+			for (offset = 0; offset < total && err == ERR_OK; offset += n)
+			{
+				n = sizeof(up->rxbuf) - up->rxlen;
+				if (n > total - offset)
+					n = total - offset;
+				netbuf_copy_partial(inbuf, &up->rxbuf[up->rxlen], n, offset);
+				up->rxlen += n;
+				err = ModbusTcpGateParse(up);
+			}
+			netbuf_delete(inbuf);
+
+			if (err != ERR_OK)
+				break;
+		}
+
+		//连接断开，挂起在该连接上的请求将在等待超时后返回错误
+		//持有lock时没有客户端子任务正在该连接上发送，之后也不会再选中该连接
+		sys_sem_wait(&up->lock);
+		SYS_ARCH_PROTECT(lev);
+		up->conn = NULL;
+		SYS_ARCH_UNPROTECT(lev);
+		sys_sem_signal(&up->lock);
+
+		netconn_close(conn);
+		netconn_delete(conn);
+		sys_msleep(MB_TCPGATE_RECONNECT);
+	}
+}
+
+/**
+*将Modbus/TCP请求转发到下游Modbus/TCP设备，等待其响应并返回给客户端
+*conn:对应客户端的连接结构；req、len:来自客户端的Modbus/TCP请求
+*返回值：正确处理则返回MBGATE_ERROK，否则返回响应错误值
+*/
+eMBGATEErrorCode ModbusTcpGateForward(struct netconn *conn, const unsigned char *req, u16_t len)
+{
+	eMBGATEErrorCode processflag = MBGATE_ERROK;
+	const mb_tcpgate_route_t *route = NULL;
+	mb_upstream_t *up = NULL;
+	mb_trans_t *trans = NULL;
+	mb_frame_t *frame = NULL;
+	unsigned int idx;
+	unsigned int usPID, usLength;
+	unsigned char claimed;
+	err_t err;
+	SYS_ARCH_DECL_PROTECT(lev);
+
+	do
+	{
+		//校验Modbus/TCP请求帧
+		if (len > MBPOOL_FRAME_SIZE || len < LWIP_TCP_FUNC)
+		{
+			processflag = MBGATE_BADREQUEST;
+			break;
+		}
+
+		usPID = (req[LWIP_TCP_PID] << 8U) + req[LWIP_TCP_PID+1];
+		usLength = (req[LWIP_TCP_LEN] << 8U) + req[LWIP_TCP_LEN+1];
+		route = ModbusTcpGateRoute(req[LWIP_TCP_UID]);
+		if (usPID != MODBUSTCP_PROTOCOL_ID || (usLength + LWIP_TCP_UID) != len || route == NULL)
+		{
+			processflag = MBGATE_BADPROCTOL;
+			break;
+		}
+
+		//分配事务对象和帧缓冲
+		trans = ModbusPoolAlloc(MBPOOL_TRANS);
+		frame = ModbusPoolAlloc(MBPOOL_FRAME);
+		if (trans == NULL || frame == NULL)
+		{
+			processflag = MBGATE_ERRNOMEM;
+			break;
+		}
+		idx = ModbusPoolIndex(MBPOOL_TRANS, trans);
+
+		memcpy(frame->buf, req, len);
+		frame->len = len;
+
+		trans->conn     = conn;
+		trans->tid      = (req[LWIP_TCP_TID] << 8U) + req[LWIP_TCP_TID+1];
+		trans->uid      = req[LWIP_TCP_UID];
+		trans->func     = req[LWIP_TCP_FUNC];
+		trans->start    = OSTimeGet();
+		trans->frame    = frame;
+
+		//选择下游连接，改写TID并登记挂起的事务，之后接收任务就可以交付该事务的响应
+		//选择与挂起计数在同一临界区内完成，并发的请求能均匀分布到各条下游连接上
+		SYS_ARCH_PROTECT(lev);
+		up = ModbusTcpGateSelect(route);
+		if (up != NULL)
+		{
+			trans->upstream = up;
+			trans->up_tid = (unsigned short)((idx << 8) | tcpgate_seq[idx]++);
+			tcpgate_pending[idx] = trans;
+			up->pending++;
+		}
+		SYS_ARCH_UNPROTECT(lev);
+
+		if (up == NULL)
+		{
+			processflag = MBGATE_ERRNOCONN;
+			break;
+		}
+
+		frame->buf[LWIP_TCP_TID] = trans->up_tid >> 8U;
+		frame->buf[LWIP_TCP_TID+1] = trans->up_tid & 0xFF;
+
+		//在下游连接上发送请求，不等待前面的请求完成
+		sys_sem_wait(&up->lock);
+		err = (up->conn != NULL) ? netconn_write(up->conn, frame->buf, len, NETCONN_COPY) : ERR_CONN;
+		sys_sem_signal(&up->lock);
+
+		if (err != ERR_OK)
+		{
+			processflag = MBGATE_ERRSENDTCP;
+		}
+		else if (sys_arch_sem_wait(&tcpgate_done[idx], MB_TCPGATE_TIMEOUT) == SYS_ARCH_TIMEOUT)
+		{
+			processflag = MBGATE_ERRRECVTCP;
+		}
+
+		if (processflag != MBGATE_ERROK)
+		{
+			//撤销挂起的事务；若接收任务恰好已取走该事务，则响应即将交付，等待其完成
+			SYS_ARCH_PROTECT(lev);
+			claimed = (tcpgate_pending[idx] != trans);
+			if (!claimed)
+			{
+				tcpgate_pending[idx] = NULL;
+				up->pending--;
+			}
+			SYS_ARCH_UNPROTECT(lev);
+
+			if (!claimed)
+				break;
+
+			sys_sem_wait(&tcpgate_done[idx]);
+			processflag = MBGATE_ERROK;
+		}
+
+		//恢复客户端原来的TID，向客户端返回响应
+		frame->buf[LWIP_TCP_TID] = trans->tid >> 8U;
+		frame->buf[LWIP_TCP_TID+1] = trans->tid & 0xFF;
+		if (netconn_write(conn, frame->buf, frame->len, NETCONN_COPY) != ERR_OK)
+		{
+			processflag = MBGATE_ERRSEND;
+			break;
+		}
+
+		ModbusStatsInc(MB_STAT_RESPONSE);
+		ModbusStatsAdd(MB_STAT_TX_BYTES, frame->len);
+		ModbusCaptureRecord(MB_CAP_TCP_RSP, frame->buf, frame->len);
+		if (frame->len > LWIP_TCP_FUNC && (frame->buf[LWIP_TCP_FUNC] & 0x80))    //下游设备返回了异常响应
+		{
+			ModbusStatsInc(MB_STAT_EXCEPTION);
+		}
+
+	}while(0);
+
+	ModbusPoolFree(MBPOOL_FRAME, frame);
+	ModbusPoolFree(MBPOOL_TRANS, trans);
+
+	return processflag;
+}
+
+//网关转发初始化，为每个下游设备创建持久连接的接收任务
+void ModbusTcpGateInit(void)
+{
+	unsigned int r, i;
+	mb_upstream_t *up;
+
+	for (i = 0; i < MBPOOL_TRANS_NUM; i++)
+	{
+		tcpgate_pending[i] = NULL;
+		sys_sem_new(&tcpgate_done[i], 0);
+	}
+
+	for (r = 0; r < MB_TCPGATE_ROUTE_NUM; r++)
+	{
+		for (i = 0; i < MB_TCPGATE_CONN_NUM; i++)
+		{
+			up = &tcpgate_upstreams[r * MB_TCPGATE_CONN_NUM + i];
+			up->route = &tcpgate_routes[r];
+			up->conn = NULL;
+			up->pending = 0;
+			up->rxlen = 0;
+			sys_sem_new(&up->lock, 1);
+			sys_thread_new("mb_tcpgate_thread", ModbusTcpGateThread, up,
+						   MB_TCPGATE_THREAD_STKSIZE, MB_TCPGATE_THREAD_PRIO);
+		}
+	}
+}
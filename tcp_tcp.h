@@ -0,0 +1,64 @@
+#ifndef __TCP_TCP_H__
+#define __TCP_TCP_H__
+
+/**
+*Modbus/TCP到Modbus/TCP的网关转发。单元标识符（UID）落在路由表中的请求不再发往RS485，
+*而是转发到对应的下游Modbus/TCP设备。网关与每个下游设备之间保持若干条持久连接，
+*多个客户端连接的请求在同一条下游连接上流水发送，网关改写请求的事务标识符（TID）
+*以区分各个请求，收到响应后再恢复为客户端原来的TID。
+*
+*注：本文件与其余部分一样使用lwip 1.4的netconn API（struct ip_addr、IP4_ADDR）。下游连接由接收任务读、
+*由各客户端子任务写，lwip 1.4中netconn的API调用默认通过连接的op_completed信号量等待内核线程完成，
+*不同任务同时收发同一netconn时会相互唤醒，因此配置了路由表时须在lwipopts.h中使能
+*LWIP_TCPIP_CORE_LOCKING，API调用直接在内核锁内执行。各写者之间由下游连接的lock互斥。
+**/
+
+#include "tcp_rtu.h"
+
+/**
+*路由表：UID起始值、UID结束值、下游设备IP地址（4个字节）、下游设备端口。可在编译时覆盖，例如：
+*#define MB_TCPGATE_ROUTE_TABLE(X) \
+*	X(100, 109, 192,168,1,120, 502) \
+*	X(110, 110, 192,168,1,121, 502)
+*/
+#ifndef MB_TCPGATE_ROUTE_TABLE
+#define  MB_TCPGATE_ROUTE_TABLE(X)
+#endif
+
+//与每个下游设备之间保持的持久连接数
+#ifndef MB_TCPGATE_CONN_NUM
+#define  MB_TCPGATE_CONN_NUM       2
+#endif
+
+//等待下游设备响应的超时时间（毫秒）
+#ifndef MB_TCPGATE_TIMEOUT
+#define  MB_TCPGATE_TIMEOUT        1000
+#endif
+
+//下游连接断开后的重连间隔（毫秒）
+#ifndef MB_TCPGATE_RECONNECT
+#define  MB_TCPGATE_RECONNECT      3000
+#endif
+
+//下游连接接收任务的优先级及堆栈大小
+#ifndef MB_TCPGATE_THREAD_PRIO
+#define  MB_TCPGATE_THREAD_PRIO    (TCPIP_THREAD_PRIO+1)
+#endif
+#ifndef MB_TCPGATE_THREAD_STKSIZE
+#define  MB_TCPGATE_THREAD_STKSIZE DEFAULT_THREAD_STACKSIZE
+#endif
+
+//路由表项
+typedef struct mb_tcpgate_route
+{
+	unsigned char  uid_first;     //UID起始值
+	unsigned char  uid_last;      //UID结束值
+	unsigned char  ip[4];         //下游设备IP地址
+	unsigned short port;          //下游设备端口
+}mb_tcpgate_route_t;
+
+void ModbusTcpGateInit(void);
+const mb_tcpgate_route_t *ModbusTcpGateRoute(unsigned char uid);
+eMBGATEErrorCode ModbusTcpGateForward(struct netconn *conn, const unsigned char *req, u16_t len);
+
+#endif /* __TCP_TCP_H__ */